@@ -0,0 +1,9 @@
+TEMPLATE = app
+TARGET = example
+QT += core gui
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+include(../src/qtikzpicture.pri)
+
+SOURCES += main.cpp
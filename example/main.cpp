@@ -0,0 +1,189 @@
+/*  Copyright (c) 2012-2013, Dominik Haumann <dhaumann@kde.org>
+    All rights reserved.
+
+    License: FreeBSD License
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "qtikzpicture.h"
+
+#include <QFile>
+#include <QTextStream>
+#include <QElapsedTimer>
+#include <QPainterPath>
+#include <QColor>
+#include <QPointF>
+#include <QRectF>
+#include <QString>
+#include <QVector>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+/**
+ * Write a small example picture to 'example.tikz'.
+ */
+static int writeExample()
+{
+    QFile file("example.tikz");
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        return 1;
+    }
+    QTextStream textStream(&file);
+
+    QTikzPicture tikzPicture;
+    tikzPicture.setStream(&textStream, 3);
+    tikzPicture.begin();
+
+    tikzPicture.line(QVector<QPointF>() << QPointF(0, 0) << QPointF(1, 1), "thick, dashed");
+
+    QPainterPath path;
+    path.moveTo(0, 0);
+    path.lineTo(0, 1);
+    path.lineTo(1, 2);
+    path.lineTo(2, 1);
+    path.lineTo(2, 0);
+    path.closeSubpath();
+    tikzPicture.path(path, "fill=green!50, draw=green!50!black");
+
+    const QString col = tikzPicture.registerColor(QColor(100, 200, 0));
+    tikzPicture.circle(QPointF(1, 0.5), 0.25, "draw=" + col);
+
+    tikzPicture.end();
+    return 0;
+}
+
+/**
+ * A single benchmark workload: counts the written bytes and reports the
+ * throughput in primitives and bytes per second.
+ */
+class Workload
+{
+public:
+    explicit Workload(const char * workloadName)
+        : name(workloadName)
+        , bytes(0)
+    {
+        tikzPicture.setWriteFunction([this](const char *, size_t size) { bytes += size; }, 3);
+        tikzPicture.begin();
+        timer.start();
+    }
+
+    QTikzPicture & picture() { return tikzPicture; }
+
+    void finish(qint64 primitives)
+    {
+        tikzPicture.end();
+        const double seconds = qMax(qint64(1), timer.nsecsElapsed()) / 1e9;
+        printf("%-28s %10.3f s %14.0f prim/s %10.2f MB/s %12llu bytes\n",
+               name, seconds, primitives / seconds, bytes / seconds / 1e6,
+               (unsigned long long)bytes);
+    }
+
+private:
+    const char * name;
+    QTikzPicture tikzPicture;
+    QElapsedTimer timer;
+    quint64 bytes;
+};
+
+/**
+ * Run representative export workloads and print their throughput.
+ * When comparing runs, use the same machine and build type.
+ */
+static int runBenchmarks()
+{
+    std::mt19937 random(42);
+    std::uniform_real_distribution<double> coord(0.0, 100.0);
+
+    // 1M point polyline
+    {
+        QVector<QPointF> points;
+        points.reserve(1000000);
+        for (int i = 0; i < 1000000; ++i) {
+            points.append(QPointF(i * 1e-4, std::sin(i * 1e-3) + coord(random) * 1e-3));
+        }
+        Workload workload("line, 1M points");
+        workload.picture().line(points, "thin");
+        workload.finish(points.size());
+    }
+
+    // 100k random rects, one call each and batched
+    {
+        QVector<QRectF> rects;
+        rects.reserve(100000);
+        for (int i = 0; i < 100000; ++i) {
+            rects.append(QRectF(coord(random), coord(random), 1 + coord(random) * 0.1, 1 + coord(random) * 0.1));
+        }
+
+        Workload single("fill, 100k rects");
+        for (int i = 0; i < rects.size(); ++i) {
+            single.picture().fill(rects[i], "red");
+        }
+        single.finish(rects.size());
+
+        Workload batched("fill, 100k rects batched");
+        batched.picture().fill(rects, "red");
+        batched.finish(rects.size());
+    }
+
+    // path with 10k curves
+    {
+        QPainterPath path;
+        path.moveTo(0, 0);
+        for (int i = 0; i < 10000; ++i) {
+            path.cubicTo(QPointF(coord(random), coord(random)),
+                         QPointF(coord(random), coord(random)),
+                         QPointF(coord(random), coord(random)));
+        }
+        Workload workload("path, 10k curves");
+        workload.picture().draw(path, "blue");
+        workload.finish(path.elementCount());
+    }
+
+    // 50k distinct colors, then registered again
+    {
+        Workload workload("registerColor, 50k colors");
+        for (int pass = 0; pass < 2; ++pass) {
+            for (int i = 0; i < 50000; ++i) {
+                workload.picture().registerColor(QColor::fromRgb(i * 331 % 256, i / 256 % 256, i % 256));
+            }
+        }
+        workload.finish(2 * 50000);
+    }
+
+    return 0;
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc > 1 && strcmp(argv[1], "--benchmark") == 0) {
+        return runBenchmarks();
+    }
+
+    return writeExample();
+}
+
+// kate: replace-tabs on; indent-width 4;
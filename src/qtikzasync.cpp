@@ -0,0 +1,204 @@
+/*  Copyright (c) 2012-2013, Dominik Haumann <dhaumann@kde.org>
+    All rights reserved.
+
+    License: FreeBSD License
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "qtikzasync_p.h"
+#include "qtikzpicture_p.h"
+#include "qtikzcompressor_p.h"
+
+#include <QRunnable>
+
+#include <chrono>
+#include <future>
+
+/**
+ * Commands recorded in asynchronous mode, replayed on the worker thread.
+ */
+class QTikzAsyncChunk : public QRunnable
+{
+public:
+    explicit QTikzAsyncChunk(QTikzAsyncPipeline * owner)
+        : pipeline(owner)
+        , list(0)
+        , hasSymbols(false)
+        , finish(false)
+    {}
+
+    ~QTikzAsyncChunk()
+    {
+        delete list;
+    }
+
+    void run()
+    {
+        QTikzPicturePrivate * target = pipeline->target;
+        if (hasSymbols) {
+            target->updateSymbols(symbols);
+        }
+        target->replay(*list);
+        if (finish) {
+            target->flush();
+            if (pipeline->compressor) {
+                pipeline->compressor->waitForDone();
+            }
+        }
+        pipeline->queue.release();
+        if (finish) {
+            done.set_value();
+        }
+    }
+
+    QTikzAsyncPipeline * pipeline;
+    QTikzDisplayList * list;
+
+    // symbols as of the end of the chunk, if they have changed
+    bool hasSymbols;
+    QHash<QString, QTikzSymbol> symbols;
+
+    // hand out all output, then complete done
+    bool finish;
+    std::promise<void> done;
+};
+
+/**
+ * Queue the commands recorded so far for the worker of the asynchronous
+ * mode, and start a new display list. Blocks while the queue is full.
+ * If @p finish is @e true, the returned future is ready once the worker
+ * has written all output.
+ */
+std::shared_future<void> QTikzPicturePrivate::submitAsync(bool finish)
+{
+    flush();
+
+    QTikzAsyncChunk * chunk = new QTikzAsyncChunk(async);
+    chunk->list = displayList;
+    displayList = new QTikzDisplayList;
+    if (symbolsChanged) {
+        chunk->hasSymbols = true;
+        chunk->symbols = symbols;
+        symbolsChanged = false;
+    }
+
+    std::shared_future<void> future;
+    if (finish) {
+        chunk->finish = true;
+        future = chunk->done.get_future().share();
+    }
+
+    async->queue.acquire();
+    async->pool.start(chunk);
+    return future;
+}
+
+/**
+ * Wait until the worker of the asynchronous mode has written all output.
+ */
+void QTikzPicturePrivate::waitAsync()
+{
+    submitAsync(true).wait();
+    addOutputCounts(async->target->stats);
+}
+
+void QTikzPicture::setAsyncMode(bool enable, int queueSize)
+{
+    if (d->rasterList || enable == (d->async != 0)) return;
+
+    if (enable) {
+        if (d->displayList) return;
+        d->flush();
+
+        // the worker takes over the settings and the state of the scopes
+        QTikzAsyncPipeline * async = new QTikzAsyncPipeline(qMax(1, queueSize));
+        QTikzPicturePrivate * target = async->picture.d;
+        async->target = target;
+        target->setSink(d->ts, d->device, d->writeFunction, d->writer.precision);
+        target->copySettings(*d);
+        target->optionTable = d->optionTable;
+        target->styleStack = d->styleStack;
+        target->symbols = d->symbols;
+        target->symbolStack = d->symbolStack;
+        target->scopeDepth = d->scopeDepth;
+        target->clipBounds = d->clipBounds;
+        target->clipStack = d->clipStack;
+
+        // both sides name styles from now on
+        async->styleCount.store(d->styleCount);
+        d->sharedStyleCount = &async->styleCount;
+        target->sharedStyleCount = &async->styleCount;
+
+        // compresses the output on a thread of its own
+        if (d->compressor) {
+            async->compressor = d->compressor;
+            d->compressor->setThreaded(true);
+        }
+
+        d->async = async;
+        d->symbolsChanged = false;
+        d->displayList = new QTikzDisplayList;
+    } else {
+        d->waitAsync();
+
+        // and hands the state back
+        QTikzPicturePrivate * target = d->async->target;
+        d->optionTable = target->optionTable;
+        d->styleStack = target->styleStack;
+        d->styleCount = d->async->styleCount.load();
+        d->sharedStyleCount = 0;
+        d->symbols = target->symbols;
+        d->symbolStack = target->symbolStack;
+        d->scopeDepth = target->scopeDepth;
+        d->clipBounds = target->clipBounds;
+        d->clipStack = target->clipStack;
+
+        delete d->async;
+        d->async = 0;
+        if (d->compressor) {
+            d->compressor->setThreaded(false);
+        }
+        delete d->displayList;
+        d->displayList = 0;
+    }
+}
+
+bool QTikzPicture::asyncMode() const
+{
+    return d->async != 0;
+}
+
+bool QTikzPicture::isFinished() const
+{
+    return !d->finished.valid()
+        || d->finished.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+void QTikzPicture::waitForFinished()
+{
+    if (d->finished.valid()) {
+        d->finished.wait();
+    }
+}
+
+// kate: replace-tabs on; indent-width 4;
@@ -0,0 +1,83 @@
+/*  Copyright (c) 2012-2013, Dominik Haumann <dhaumann@kde.org>
+    All rights reserved.
+
+    License: FreeBSD License
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef QT_TIKZ_ASYNC_P_H
+#define QT_TIKZ_ASYNC_P_H
+
+#include "qtikzpicture.h"
+
+#include <QAtomicInt>
+#include <QSemaphore>
+#include <QThreadPool>
+
+class QTikzPicturePrivate;
+class QTikzCompressor;
+
+/**
+ * Recorded commands and values per chunk of the asynchronous mode.
+ */
+static const int AsyncChunkSize = 1 << 16;
+
+/**
+ * The worker of the asynchronous mode, see QTikzPicture::setAsyncMode().
+ */
+class QTikzAsyncPipeline
+{
+public:
+    explicit QTikzAsyncPipeline(int queueSize)
+        : target(0)
+        , compressor(0)
+        , queue(queueSize)
+    {
+        pool.setMaxThreadCount(1);
+    }
+
+    ~QTikzAsyncPipeline()
+    {
+        pool.waitForDone();
+    }
+
+    // formats and writes the commands, used by the worker thread only
+    QTikzPicture picture;
+    QTikzPicturePrivate * target;
+
+    // the compression thread behind the sink, if any
+    QTikzCompressor * compressor;
+
+    // a single thread, so the chunks run in the order they were queued
+    QThreadPool pool;
+
+    // number of styles named by the picture and by the worker
+    QAtomicInt styleCount;
+
+    // free places in the queue
+    QSemaphore queue;
+};
+
+#endif // QT_TIKZ_ASYNC_P_H
+
+// kate: replace-tabs on; indent-width 4;
@@ -0,0 +1,227 @@
+/*  Copyright (c) 2012-2013, Dominik Haumann <dhaumann@kde.org>
+    All rights reserved.
+
+    License: FreeBSD License
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "qtikzpicture_p.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileDevice>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+
+#include <QDebug>
+
+/**
+ * Private data class for QTikzBatchExporter.
+ */
+class QTikzBatchExporterPrivate
+{
+public:
+    explicit QTikzBatchExporterPrivate(const QString & preambleFileName)
+        : preamble(preambleFileName)
+        , figures(0)
+        , failed(false)
+        , elapsedTime(0)
+        , threadCount(0)
+    {}
+
+    void exportFigure(const QString & fileName, const QTikzBatchExporter::DrawFunction & draw,
+                      const QString & options);
+    QTikzStats totalStats() const;
+
+    QFile preamble;
+    QTikzPicture registry;
+
+    // the results of the figures, guarded by mutex
+    mutable QMutex mutex;
+    QTikzStats stats;
+    int figures;
+    bool failed;
+    QElapsedTimer timer;    // started by the first figure
+    qint64 elapsedTime;
+
+    // exports the figures, waits for them when deleted
+    int threadCount;
+    QThreadPool pool;
+};
+
+/**
+ * A figure queued by QTikzBatchExporter::exportFigure().
+ */
+class QTikzBatchFigure : public QRunnable
+{
+public:
+    QTikzBatchFigure(QTikzBatchExporterPrivate * owner, const QString & figureFileName,
+                     const QTikzBatchExporter::DrawFunction & drawFunction, const QString & figureOptions)
+        : exporter(owner)
+        , fileName(figureFileName)
+        , draw(drawFunction)
+        , options(figureOptions)
+    {}
+
+    void run()
+    {
+        exporter->exportFigure(fileName, draw, options);
+    }
+
+    QTikzBatchExporterPrivate * exporter;
+    const QString fileName;
+    const QTikzBatchExporter::DrawFunction draw;
+    const QString options;
+};
+
+void QTikzBatchExporterPrivate::exportFigure(const QString & fileName,
+                                             const QTikzBatchExporter::DrawFunction & draw,
+                                             const QString & options)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "QTikzPicture: cannot write figure" << fileName;
+        QMutexLocker locker(&mutex);
+        failed = true;
+        return;
+    }
+
+    // colors are defined in the preamble under the lock of the registry,
+    // like the layers of a QTikzRecorder
+    QTikzPicture figure;
+    QTikzPicturePrivate * source = registry.d;
+    QTikzPicturePrivate * target = figure.d;
+    target->setSink(0, &file, QTikzPicture::WriteFunction(), source->writer.precision);
+    target->copySettings(*source);
+    target->shared = source;
+    target->statsEnabled = true;
+
+    // the registered styles are defined in the preamble, outside of all scopes
+    for (auto it = source->optionTable.constBegin(); it != source->optionTable.constEnd(); ++it) {
+        if (it.value().depth >= 0) {
+            QTikzOptionEntry & entry = target->optionTable[it.key()];
+            entry = it.value();
+            entry.depth = 0;
+        }
+    }
+
+    figure.begin(options);
+    draw(figure);
+    figure.end();
+    file.close();
+
+    QMutexLocker locker(&mutex);
+    stats += target->stats;
+    ++figures;
+    failed = failed || file.error() != QFileDevice::NoError;
+    elapsedTime = timer.nsecsElapsed();
+}
+
+QTikzStats QTikzBatchExporterPrivate::totalStats() const
+{
+    QMutexLocker locker(&mutex);
+    QTikzStats total = stats;
+
+    // the preamble with the colors defined by the figures
+    QMutexLocker registryLocker(&registry.d->mutex);
+    total += registry.stats();
+    return total;
+}
+
+QTikzBatchExporter::QTikzBatchExporter(const QString & preambleFileName, int precision)
+    : d(new QTikzBatchExporterPrivate(preambleFileName))
+{
+    if (d->preamble.open(QIODevice::WriteOnly)) {
+        d->registry.setDevice(&d->preamble, precision);
+    } else {
+        qWarning() << "QTikzPicture: cannot write preamble" << preambleFileName;
+        d->failed = true;
+    }
+    d->registry.setStatsEnabled(true);
+    d->pool.setMaxThreadCount(QThread::idealThreadCount());
+}
+
+QTikzBatchExporter::~QTikzBatchExporter()
+{
+    finish();
+    delete d;
+}
+
+QTikzPicture & QTikzBatchExporter::registry()
+{
+    return d->registry;
+}
+
+void QTikzBatchExporter::setThreadCount(int count)
+{
+    d->threadCount = qMax(0, count);
+    d->pool.setMaxThreadCount(d->threadCount > 0 ? d->threadCount : QThread::idealThreadCount());
+}
+
+int QTikzBatchExporter::threadCount() const
+{
+    return d->threadCount;
+}
+
+void QTikzBatchExporter::exportFigure(const QString & fileName, const DrawFunction & draw,
+                                      const QString & options)
+{
+    {
+        QMutexLocker locker(&d->mutex);
+        if (!d->timer.isValid()) {
+            d->timer.start();
+        }
+    }
+    d->pool.start(new QTikzBatchFigure(d, fileName, draw, options));
+}
+
+bool QTikzBatchExporter::finish()
+{
+    d->pool.waitForDone();
+    d->registry.flush();
+
+    QMutexLocker locker(&d->mutex);
+    return !d->failed && d->preamble.error() == QFileDevice::NoError;
+}
+
+int QTikzBatchExporter::figureCount() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->figures;
+}
+
+QTikzStats QTikzBatchExporter::stats() const
+{
+    return d->totalStats();
+}
+
+qint64 QTikzBatchExporter::elapsedTime() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->elapsedTime;
+}
+
+// kate: replace-tabs on; indent-width 4;
@@ -0,0 +1,173 @@
+/*  Copyright (c) 2012-2013, Dominik Haumann <dhaumann@kde.org>
+    All rights reserved.
+
+    License: FreeBSD License
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "qtikzclip_p.h"
+
+bool clipSegment(QPointF & p0, QPointF & p1, const QTikzBounds & clip)
+{
+    const QPointF start = p0;
+    const QPointF delta = p1 - p0;
+    const qreal p[4] = { -delta.x(), delta.x(), -delta.y(), delta.y() };
+    const qreal q[4] = { start.x() - clip.left, clip.right - start.x(),
+                         start.y() - clip.top, clip.bottom - start.y() };
+
+    qreal t0 = 0;
+    qreal t1 = 1;
+    for (int k = 0; k < 4; ++k) {
+        if (p[k] == 0) {
+            // parallel to this edge
+            if (q[k] < 0) return false;
+        } else {
+            const qreal t = q[k] / p[k];
+            if (p[k] < 0) {
+                if (t > t1) return false;
+                t0 = qMax(t0, t);
+            } else {
+                if (t < t0) return false;
+                t1 = qMin(t1, t);
+            }
+        }
+    }
+
+    if (t0 > 0) p0 = start + t0 * delta;
+    if (t1 < 1) p1 = start + t1 * delta;
+    return true;
+}
+
+void clipPolyline(const QPointF * points, int count, const QTikzBounds & clip,
+                  QVector<QPointF> & result, QVector<int> & pieceEnds, QVector<quint8> & outcodes)
+{
+    // branch-free, so that the compiler can vectorize this pass
+    outcodes.resize(count);
+    quint8 * codes = outcodes.data();
+    for (int i = 0; i < count; ++i) {
+        const qreal x = points[i].x();
+        const qreal y = points[i].y();
+        codes[i] = quint8(int(x < clip.left) | (int(x > clip.right) << 1)
+                        | (int(y < clip.top) << 2) | (int(y > clip.bottom) << 3));
+    }
+
+    // if a piece is open, its last point is points[i], which is inside
+    bool open = false;
+    for (int i = 0; i + 1 < count; ++i) {
+        const int code0 = codes[i];
+        const int code1 = codes[i + 1];
+
+        if ((code0 | code1) == 0) {
+            if (!open) {
+                result.append(points[i]);
+                open = true;
+            }
+            result.append(points[i + 1]);
+            continue;
+        }
+
+        QPointF p0 = points[i];
+        QPointF p1 = points[i + 1];
+        if ((code0 & code1) != 0 || !clipSegment(p0, p1, clip)) {
+            if (open) {
+                pieceEnds.append(result.size());
+                open = false;
+            }
+            continue;
+        }
+
+        if (!open) {
+            result.append(p0);
+            open = true;
+        }
+        result.append(p1);
+        if (code1 != 0) {
+            pieceEnds.append(result.size());
+            open = false;
+        }
+    }
+
+    if (open) {
+        pieceEnds.append(result.size());
+    }
+}
+
+/**
+ * Signed distance of @p pt to one edge of @p clip, positive inside.
+ * The edges are numbered left, right, top, bottom.
+ */
+static inline qreal edgeDistance(const QPointF & pt, const QTikzBounds & clip, int edge)
+{
+    switch (edge) {
+    case 0: return pt.x() - clip.left;
+    case 1: return clip.right - pt.x();
+    case 2: return pt.y() - clip.top;
+    default: return clip.bottom - pt.y();
+    }
+}
+
+/**
+ * Append @p pt to @p polygon, unless it repeats the last point.
+ */
+static inline void appendVertex(QPolygonF & polygon, const QPointF & pt)
+{
+    if (polygon.isEmpty() || polygon.last().x() != pt.x() || polygon.last().y() != pt.y()) {
+        polygon.append(pt);
+    }
+}
+
+void clipPolygon(const QPointF * points, int count, const QTikzBounds & clip,
+                 QPolygonF & result, QPolygonF & scratch)
+{
+    result.resize(0);
+    for (int i = 0; i < count; ++i) {
+        result.append(points[i]);
+    }
+
+    const qreal bounds[4] = { clip.left, clip.right, clip.top, clip.bottom };
+    for (int edge = 0; edge < 4 && !result.isEmpty(); ++edge) {
+        if (qAbs(bounds[edge]) == std::numeric_limits<qreal>::infinity()) continue;
+
+        scratch.swap(result);
+        result.resize(0);
+
+        const int size = scratch.size();
+        QPointF previous = scratch[size - 1];
+        qreal previousDistance = edgeDistance(previous, clip, edge);
+        for (int i = 0; i < size; ++i) {
+            const QPointF current = scratch[i];
+            const qreal distance = edgeDistance(current, clip, edge);
+            if ((distance >= 0) != (previousDistance >= 0)) {
+                const qreal t = previousDistance / (previousDistance - distance);
+                appendVertex(result, previous + t * (current - previous));
+            }
+            if (distance >= 0) {
+                appendVertex(result, current);
+            }
+            previous = current;
+            previousDistance = distance;
+        }
+    }
+}
+
+// kate: replace-tabs on; indent-width 4;
@@ -0,0 +1,129 @@
+/*  Copyright (c) 2012-2013, Dominik Haumann <dhaumann@kde.org>
+    All rights reserved.
+
+    License: FreeBSD License
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef QT_TIKZ_CLIP_P_H
+#define QT_TIKZ_CLIP_P_H
+
+#include <QPointF>
+#include <QPolygonF>
+#include <QVector>
+
+#include <limits>
+
+/**
+ * Axis-aligned bounding box, used to cull geometry outside the clip
+ * rectangle. The default box is unbounded.
+ */
+struct QTikzBounds
+{
+    QTikzBounds()
+        : left(-std::numeric_limits<qreal>::infinity())
+        , top(-std::numeric_limits<qreal>::infinity())
+        , right(std::numeric_limits<qreal>::infinity())
+        , bottom(std::numeric_limits<qreal>::infinity())
+    {}
+
+    QTikzBounds(qreal x1, qreal y1, qreal x2, qreal y2)
+        : left(qMin(x1, x2)), top(qMin(y1, y2)), right(qMax(x1, x2)), bottom(qMax(y1, y2))
+    {}
+
+    QTikzBounds(const QPointF * points, int count)
+        : left(points[0].x()), top(points[0].y()), right(left), bottom(top)
+    {
+        for (int i = 1; i < count; ++i) {
+            left = qMin(left, points[i].x());
+            top = qMin(top, points[i].y());
+            right = qMax(right, points[i].x());
+            bottom = qMax(bottom, points[i].y());
+        }
+    }
+
+    void intersect(const QTikzBounds & other)
+    {
+        left = qMax(left, other.left);
+        top = qMax(top, other.top);
+        right = qMin(right, other.right);
+        bottom = qMin(bottom, other.bottom);
+    }
+
+    QTikzBounds adjusted(qreal margin) const
+    {
+        QTikzBounds result = *this;
+        result.left -= margin;
+        result.top -= margin;
+        result.right += margin;
+        result.bottom += margin;
+        return result;
+    }
+
+    // unlike QRectF::intersects(), this also works for lines of zero width or height
+    bool isOutside(const QTikzBounds & clip) const
+    {
+        return right < clip.left || left > clip.right
+            || bottom < clip.top || top > clip.bottom
+            || clip.left > clip.right || clip.top > clip.bottom;
+    }
+
+    bool isInside(const QTikzBounds & clip) const
+    {
+        return left >= clip.left && right <= clip.right
+            && top >= clip.top && bottom <= clip.bottom;
+    }
+
+    qreal left;
+    qreal top;
+    qreal right;
+    qreal bottom;
+};
+
+/**
+ * Clip the line segment from @p p0 to @p p1 to @p clip with the
+ * Liang-Barsky algorithm. Returns false if the segment is invisible.
+ */
+bool clipSegment(QPointF & p0, QPointF & p1, const QTikzBounds & clip);
+
+/**
+ * Clip the polyline @p points of size @p count to @p clip. The visible
+ * pieces are appended to @p result, and the end index of each piece in
+ * @p result to @p pieceEnds. Segments are accepted or rejected with
+ * Cohen-Sutherland outcodes, and only the ones crossing the clip edges
+ * are clipped with clipSegment(). @p outcodes is a scratch buffer.
+ */
+void clipPolyline(const QPointF * points, int count, const QTikzBounds & clip,
+                  QVector<QPointF> & result, QVector<int> & pieceEnds, QVector<quint8> & outcodes);
+
+/**
+ * Clip the closed polygon @p points of size @p count to @p clip with the
+ * Sutherland-Hodgman algorithm. The clipped polygon is stored in
+ * @p result, @p scratch is a scratch buffer.
+ */
+void clipPolygon(const QPointF * points, int count, const QTikzBounds & clip,
+                 QPolygonF & result, QPolygonF & scratch);
+
+#endif // QT_TIKZ_CLIP_P_H
+
+// kate: replace-tabs on; indent-width 4;
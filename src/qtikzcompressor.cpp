@@ -0,0 +1,148 @@
+/*  Copyright (c) 2012-2013, Dominik Haumann <dhaumann@kde.org>
+    All rights reserved.
+
+    License: FreeBSD License
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "qtikzcompressor_p.h"
+
+#include <QIODevice>
+#include <QRunnable>
+
+#include <QDebug>
+
+quint32 crc32(quint32 crc, const char * data, int size)
+{
+    static const struct Table {
+        quint32 entries[256];
+        Table()
+        {
+            for (quint32 i = 0; i < 256; ++i) {
+                quint32 c = i;
+                for (int k = 0; k < 8; ++k) {
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                }
+                entries[i] = c;
+            }
+        }
+    } table;
+
+    crc = ~crc;
+    for (int i = 0; i < size; ++i) {
+        crc = table.entries[(crc ^ uchar(data[i])) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/**
+ * A chunk compressed on the thread of a QTikzCompressor.
+ */
+class QTikzCompressorChunk : public QRunnable
+{
+public:
+    QTikzCompressorChunk(QTikzCompressor * owner, const char * chunkData, int size)
+        : compressor(owner)
+        , data(chunkData, size)
+    {}
+
+    void run()
+    {
+        compressor->writeMember(data.constData(), data.size());
+        compressor->queue.release();
+    }
+
+    QTikzCompressor * compressor;
+    const QByteArray data;
+};
+
+void QTikzCompressor::compress(const char * data, size_t size)
+{
+    if (size == 0) return;
+
+    if (!pool) {
+        writeMember(data, int(size));
+        return;
+    }
+
+    queue.acquire();
+    pool->start(new QTikzCompressorChunk(this, data, int(size)));
+}
+
+void QTikzCompressor::setThreaded(bool threaded)
+{
+    if (threaded == (pool != 0)) return;
+
+    if (threaded) {
+        pool = new QThreadPool;
+        pool->setMaxThreadCount(1);
+    } else {
+        delete pool;
+        pool = 0;
+    }
+}
+
+void QTikzCompressor::waitForDone()
+{
+    if (pool) {
+        pool->waitForDone();
+    }
+}
+
+void QTikzCompressor::writeMember(const char * data, int size)
+{
+    // qCompress() returns the size as 4 bytes, followed by the zlib stream:
+    // a 2 byte header, the deflate data and an Adler-32 checksum of 4 bytes.
+    // For no data, it returns no stream, so use a final fixed block instead.
+    static const char emptyDeflate[2] = { 3, 0 };
+    const char * deflate = emptyDeflate;
+    qint64 deflateSize = sizeof(emptyDeflate);
+    QByteArray zlib;
+    if (size > 0) {
+        zlib = qCompress(reinterpret_cast<const uchar *>(data), size, level);
+        if (zlib.size() < 10) {
+            qWarning() << "QTikzPicture: cannot compress output";
+            return;
+        }
+        deflate = zlib.constData() + 6;
+        deflateSize = zlib.size() - 10;
+    }
+
+    // gzip header: magic, deflate, no flags, no time, no extra flags, unknown OS
+    static const char header[10] = { '\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, '\xff' };
+
+    const quint32 crc = crc32(0, data, size);
+    char trailer[8];
+    for (int i = 0; i < 4; ++i) {
+        trailer[i] = char(crc >> (8 * i));
+        trailer[4 + i] = char(quint32(size) >> (8 * i));
+    }
+
+    if (device->write(header, sizeof(header)) != qint64(sizeof(header))
+        || device->write(deflate, deflateSize) != deflateSize
+        || device->write(trailer, sizeof(trailer)) != qint64(sizeof(trailer))) {
+        qWarning() << "QTikzPicture: cannot write compressed output";
+    }
+}
+
+// kate: replace-tabs on; indent-width 4;
@@ -0,0 +1,99 @@
+/*  Copyright (c) 2012-2013, Dominik Haumann <dhaumann@kde.org>
+    All rights reserved.
+
+    License: FreeBSD License
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef QT_TIKZ_COMPRESSOR_P_H
+#define QT_TIKZ_COMPRESSOR_P_H
+
+#include <QByteArray>
+#include <QSemaphore>
+#include <QThreadPool>
+
+#include <cstddef>
+
+class QIODevice;
+
+/**
+ * Returns the CRC-32 of @p size bytes at @p data as used by gzip,
+ * continuing from the checksum @p crc of the preceding data.
+ */
+quint32 crc32(quint32 crc, const char * data, int size);
+
+/**
+ * Chunks waiting for the compression thread, see QTikzCompressor.
+ */
+static const int CompressorQueueSize = 4;
+
+/**
+ * Writes gzip compressed output to a device, see
+ * QTikzPicture::setCompressedDevice(). Each chunk of output is compressed
+ * by qCompress() into a gzip member of its own. Decompressing the
+ * concatenated members yields the concatenated chunks.
+ */
+class QTikzCompressor
+{
+public:
+    QTikzCompressor(QIODevice * outputDevice, int compressionLevel)
+        : device(outputDevice)
+        , level(compressionLevel)
+        , pool(0)
+        , queue(CompressorQueueSize)
+    {}
+
+    ~QTikzCompressor()
+    {
+        delete pool;
+    }
+
+    /**
+     * Compress @p size bytes at @p data. If threaded, this only blocks
+     * while the queue of the compression thread is full.
+     */
+    void compress(const char * data, size_t size);
+
+    /**
+     * Compress on a thread of its own, or on the calling thread.
+     */
+    void setThreaded(bool threaded);
+
+    /**
+     * Wait until all queued chunks are written to the device.
+     */
+    void waitForDone();
+
+    void writeMember(const char * data, int size);
+
+    QIODevice * device;
+    const int level;
+    QThreadPool * pool;
+
+    // free places in the queue of the compression thread
+    QSemaphore queue;
+};
+
+#endif // QT_TIKZ_COMPRESSOR_P_H
+
+// kate: replace-tabs on; indent-width 4;
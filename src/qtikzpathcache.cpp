@@ -0,0 +1,105 @@
+/*  Copyright (c) 2012-2013, Dominik Haumann <dhaumann@kde.org>
+    All rights reserved.
+
+    License: FreeBSD License
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "qtikzpathcache_p.h"
+
+#include <cstring>
+
+/**
+ * Returns @p hash combined with @p value, see pathFingerprint().
+ */
+static inline quint64 mixFingerprint(quint64 hash, quint64 value)
+{
+    hash = (hash ^ value) * Q_UINT64_C(0x9e3779b97f4a7c15);
+    return hash ^ (hash >> 32);
+}
+
+static inline quint64 fingerprintBits(double value)
+{
+    quint64 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+quint64 settingsFingerprint(const QTikzPathWriter & writer)
+{
+    quint64 hash = mixFingerprint(quint64(writer.precision), fingerprintBits(writer.simplifyTolerance));
+    hash = mixFingerprint(hash, (writer.redundantPointRemoval ? 1 : 0) | (writer.compact ? 2 : 0)
+                                | (writer.arcDetection ? 4 : 0));
+    return mixFingerprint(hash, fingerprintBits(writer.flatteningTolerance));
+}
+
+quint64 pathFingerprint(const QPainterPath & path, const QTikzPathWriter & writer)
+{
+    quint64 hash = settingsFingerprint(writer);
+
+    const int count = path.elementCount();
+    for (int i = 0; i < count; ++i) {
+        const QPainterPath::Element & element = path.elementAt(i);
+        hash = mixFingerprint(hash, quint64(element.type));
+        hash = mixFingerprint(hash, fingerprintBits(element.x));
+        hash = mixFingerprint(hash, fingerprintBits(element.y));
+    }
+    return hash;
+}
+
+QTikzPathCache::QTikzPathCache(int maxSize)
+    : d(new QTikzPathCachePrivate())
+{
+    d->paths.setMaxCost(maxSize);
+}
+
+QTikzPathCache::~QTikzPathCache()
+{
+    delete d;
+}
+
+void QTikzPathCache::setMaxSize(int size)
+{
+    QMutexLocker locker(&d->mutex);
+    d->paths.setMaxCost(size);
+}
+
+int QTikzPathCache::maxSize() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->paths.maxCost();
+}
+
+int QTikzPathCache::size() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->paths.totalCost();
+}
+
+void QTikzPathCache::clear()
+{
+    QMutexLocker locker(&d->mutex);
+    d->paths.clear();
+}
+
+// kate: replace-tabs on; indent-width 4;
@@ -0,0 +1,103 @@
+/*  Copyright (c) 2012-2013, Dominik Haumann <dhaumann@kde.org>
+    All rights reserved.
+
+    License: FreeBSD License
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef QT_TIKZ_PATH_CACHE_P_H
+#define QT_TIKZ_PATH_CACHE_P_H
+
+#include "qtikzpicture_p.h"
+
+#include <QCache>
+#include <QMutex>
+
+/**
+ * Returns a fingerprint of the settings of @p writer affecting the output
+ * of paths.
+ */
+quint64 settingsFingerprint(const QTikzPathWriter & writer);
+
+/**
+ * Returns a fingerprint of the elements of @p path and the settings of
+ * @p writer affecting its output, used as key in QTikzPathCache.
+ */
+quint64 pathFingerprint(const QPainterPath & path, const QTikzPathWriter & writer);
+
+/**
+ * The output of a painter path in QTikzPathCache. The fingerprint may
+ * collide, so the path and settings are compared on lookup.
+ */
+struct QTikzCachedPath
+{
+    QTikzCachedPath(const QPainterPath & painterPath, const QTikzPathWriter & writer)
+        : path(painterPath)
+        , precision(writer.precision)
+        , simplifyTolerance(writer.simplifyTolerance)
+        , redundantPointRemoval(writer.redundantPointRemoval)
+        , compact(writer.compact)
+        , arcDetection(writer.arcDetection)
+        , flatteningTolerance(writer.flatteningTolerance)
+    {}
+
+    bool matches(const QPainterPath & other, const QTikzPathWriter & writer) const
+    {
+        if (precision != writer.precision || simplifyTolerance != writer.simplifyTolerance
+            || redundantPointRemoval != writer.redundantPointRemoval || compact != writer.compact
+            || arcDetection != writer.arcDetection || flatteningTolerance != writer.flatteningTolerance
+            || path.elementCount() != other.elementCount()) {
+            return false;
+        }
+        for (int i = 0; i < path.elementCount(); ++i) {
+            const QPainterPath::Element & a = path.elementAt(i);
+            const QPainterPath::Element & b = other.elementAt(i);
+            if (a.type != b.type || a.x != b.x || a.y != b.y) return false;
+        }
+        return true;
+    }
+
+    QPainterPath path;
+    int precision;
+    qreal simplifyTolerance;
+    bool redundantPointRemoval;
+    bool compact;
+    bool arcDetection;
+    qreal flatteningTolerance;
+    QByteArray output;
+};
+
+/**
+ * Private data class for QTikzPathCache.
+ */
+class QTikzPathCachePrivate
+{
+public:
+    // least recently used paths by fingerprint, the cost is the output size
+    QCache<quint64, QTikzCachedPath> paths;
+    mutable QMutex mutex;
+};
+
+#endif // QT_TIKZ_PATH_CACHE_P_H
+
+// kate: replace-tabs on; indent-width 4;
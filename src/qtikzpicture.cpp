@@ -26,407 +26,4388 @@
 */
 
 #include "qtikzpicture.h"
+#include "qtikzpicture_p.h"
+#include "qtikzasync_p.h"
+#include "qtikzcompressor_p.h"
+#include "qtikzpathcache_p.h"
 
 #include <QTextStream>
+#include <QIODevice>
+#include <QBuffer>
 #include <QPointF>
 #include <QRectF>
 #include <QLineF>
 
 #include <QPainterPath>
+#include <QPainter>
+#include <QImage>
 #include <QColor>
+#include <QFile>
+#include <QFileDevice>
+#include <QElapsedTimer>
 
-#include <QLocale>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QMutex>
+#include <QCache>
+#include <QDataStream>
+#include <QStringList>
 
 #include <QDebug>
 
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <limits>
+
+/**
+ * Maximum number of significant digits the number formatter emits.
+ * 17 digits are sufficient to represent every double exactly.
+ */
+static const int MaxSignificantDigits = 17;
+
+/**
+ * Buffer size sufficient for one formatted number, e.g. "-1.2345678901234567e-308".
+ */
+static const int NumberBufferSize = 32;
+
+/**
+ * Buffer size sufficient for one formatted coordinate "(x, y)".
+ */
+static const int CoordBufferSize = 2 * NumberBufferSize + 8;
+
+static const double s_powersOfTen[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static const qint64 s_integerPowersOfTen[] = {
+    1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL, 1000000LL, 10000000LL,
+    100000000LL, 1000000000LL, 10000000000LL, 100000000000LL,
+    1000000000000LL, 10000000000000LL, 100000000000000LL,
+    1000000000000000LL, 10000000000000000LL, 100000000000000000LL
+};
+
+/**
+ * Hint for quantize() that the decimal exponent of the value is unknown.
+ */
+static const int NoExponentHint = INT_MIN;
+
+/**
+ * Points mapped into memory at once by QTikzPicture::lineFromFile().
+ * Unmapping each window keeps the resident set small for huge files.
+ */
+static const qint64 FileWindowPoints = 1 << 20;
+
+/**
+ * Points converted and passed to the streamed polyline at once
+ * by QTikzPicture::lineFromFile().
+ */
+static const int FileBlockPoints = 4096;
+
+/**
+ * Points quantized at once by QTikzPathWriter::writePolyline().
+ */
+static const int QuantizeBlockSize = 256;
+
+/**
+ * Maximum number of consecutive relative coordinates in compact output.
+ * TeX rounds each relative step to its fixed point arithmetic, so an
+ * absolute coordinate now and then keeps the error from accumulating.
+ */
+static const int RelativeAnchorInterval = 64;
+
+static const char s_digitPairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static inline int significantDigits(int precision)
+{
+    // like printf's %g, a precision of 0 is treated as 1
+    return qBound(1, precision, MaxSignificantDigits);
+}
+
+/**
+ * Exact, but slow rounding of @p value through the C library.
+ * Used whenever the fast path in quantize() cannot guarantee correct rounding.
+ */
+static void quantizeSlow(double value, int digits, QTikzDecimal & dec)
+{
+    char buffer[64];
+    const int len = qMin(int(sizeof(buffer)) - 1,
+                         snprintf(buffer, sizeof(buffer), "%.*e", digits - 1, value));
+
+    // parse "[-]d.ddde[+-]xx", ignoring the locale dependent decimal point
+    dec.digits = 0;
+    int i = 0;
+    for (; i < len && buffer[i] != 'e'; ++i) {
+        if (buffer[i] >= '0' && buffer[i] <= '9') {
+            dec.digits = dec.digits * 10 + (buffer[i] - '0');
+        }
+    }
+
+    int exponent = 0;
+    const bool negativeExponent = (i + 1 < len && buffer[i + 1] == '-');
+    for (i += 2; i < len; ++i) {
+        exponent = exponent * 10 + (buffer[i] - '0');
+    }
+    dec.exponent = negativeExponent ? -exponent : exponent;
+    dec.digitCount = digits;
+}
+
+/**
+ * Returns the decimal exponent of @p absValue, i.e. floor(log10(absValue)),
+ * possibly off by one. If @p absValue has the exponent @p hint, the
+ * logarithm is skipped.
+ */
+static inline int decimalExponent(double absValue, int hint)
+{
+    if (hint >= 0 && hint < 22) {
+        if (absValue >= s_powersOfTen[hint] && absValue < s_powersOfTen[hint + 1]) {
+            return hint;
+        }
+    } else if (hint < 0 && hint > -22) {
+        const double scaled = absValue * s_powersOfTen[-hint];
+        if (scaled >= 1.0 && scaled < 10.0) {
+            return hint;
+        }
+    }
+
+    return int(std::floor(std::log10(absValue)));
+}
+
+/**
+ * Round @p value to @p precision significant digits. The result is
+ * identical to the rounding performed by QLocale::toString(value, 'g', precision).
+ *
+ * When rounding a sequence of values, pass the same @p exponentHint for
+ * each call: consecutive coordinates mostly have the same magnitude, and
+ * reusing the exponent of the previous value avoids the logarithm.
+ */
+static QTikzDecimal quantize(double value, int precision, int * exponentHint = 0)
+{
+    QTikzDecimal dec;
+    dec.negative = std::signbit(value);
+    dec.kind = QTikzDecimal::Finite;
+    dec.digits = 0;
+    dec.digitCount = 1;
+    dec.exponent = 0;
+
+    if (std::isnan(value)) {
+        dec.kind = QTikzDecimal::NaN;
+        return dec;
+    }
+    if (std::isinf(value)) {
+        dec.kind = QTikzDecimal::Infinite;
+        return dec;
+    }
+    if (value == 0.0) {
+        return dec;
+    }
+
+    const int digits = significantDigits(precision);
+    const double absValue = std::fabs(value);
+
+    // fast path: scale into [10^(digits-1), 10^digits) and round to an integer
+    bool exact = false;
+    if (digits <= 15) {
+        int exponent = decimalExponent(absValue, exponentHint ? *exponentHint : NoExponentHint);
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            const int scale = digits - 1 - exponent;
+            if (scale < -22 || scale > 22) {
+                break;
+            }
+
+            const double scaled = scale >= 0 ? absValue * s_powersOfTen[scale]
+                                             : absValue / s_powersOfTen[-scale];
+            if (scaled < s_powersOfTen[digits - 1]) {
+                --exponent;
+                continue;
+            } else if (scaled >= s_powersOfTen[digits]) {
+                ++exponent;
+                continue;
+            }
+
+            // scaled is off by at most half an ulp from the exact product.
+            // If it is too close to a rounding boundary, fall back to the slow path.
+            const double integral = std::floor(scaled);
+            const double fraction = scaled - integral;
+            if (std::fabs(fraction - 0.5) <= scaled * 4.5e-16) {
+                break;
+            }
+
+            dec.digits = qint64(integral) + (fraction > 0.5 ? 1 : 0);
+            if (dec.digits == s_integerPowersOfTen[digits]) {
+                dec.digits = s_integerPowersOfTen[digits - 1];
+                ++exponent;
+            }
+            dec.digitCount = digits;
+            dec.exponent = exponent;
+            exact = true;
+            break;
+        }
+    }
+
+    if (!exact) {
+        quantizeSlow(absValue, digits, dec);
+    }
+    if (exponentHint) {
+        *exponentHint = dec.exponent;
+    }
+
+    // strip trailing zeros
+    while (dec.digitCount > 1 && dec.digits % 10 == 0) {
+        dec.digits /= 10;
+        --dec.digitCount;
+    }
+
+    return dec;
+}
+
+/**
+ * Write the decimal @p dec to @p buffer in the notation of printf's %g,
+ * i.e. without trailing zeros and in scientific notation for very small
+ * or large exponents. Unlike printf, negative zero is written as 0.
+ * The buffer must provide at least NumberBufferSize bytes.
+ * Returns the amount of characters written, no terminating 0 is appended.
+ */
+static int formatDecimal(char * buffer, const QTikzDecimal & dec, int precision)
+{
+    char * out = buffer;
+    const bool zero = dec.kind == QTikzDecimal::Finite && dec.digits == 0;
+    if (dec.negative && dec.kind != QTikzDecimal::NaN && !zero) {
+        *out++ = '-';
+    }
+
+    if (dec.kind == QTikzDecimal::NaN) {
+        memcpy(out, "nan", 3);
+        return int(out - buffer) + 3;
+    } else if (dec.kind == QTikzDecimal::Infinite) {
+        memcpy(out, "inf", 3);
+        return int(out - buffer) + 3;
+    }
+
+    // extract the significant digits, most significant first, two at a time
+    char digits[MaxSignificantDigits + 1];
+    qint64 value = dec.digits;
+    int i = dec.digitCount;
+    while (i >= 2) {
+        const int pair = int(value % 100);
+        value /= 100;
+        i -= 2;
+        memcpy(digits + i, s_digitPairs + 2 * pair, 2);
+    }
+    if (i == 1) {
+        digits[0] = char('0' + value);
+    }
+
+    const int exponent = dec.exponent;
+    if (exponent < -4 || exponent >= significantDigits(precision)) {
+        // scientific notation: d[.ddd]e[+-]xx
+        *out++ = digits[0];
+        if (dec.digitCount > 1) {
+            *out++ = '.';
+            memcpy(out, digits + 1, dec.digitCount - 1);
+            out += dec.digitCount - 1;
+        }
+        *out++ = 'e';
+        *out++ = exponent < 0 ? '-' : '+';
+        const int absExponent = exponent < 0 ? -exponent : exponent;
+        if (absExponent >= 100) {
+            *out++ = char('0' + absExponent / 100);
+        }
+        *out++ = char('0' + (absExponent / 10) % 10);
+        *out++ = char('0' + absExponent % 10);
+    } else if (exponent < 0) {
+        // 0.000ddd
+        *out++ = '0';
+        *out++ = '.';
+        for (int i = -1; i > exponent; --i) {
+            *out++ = '0';
+        }
+        memcpy(out, digits, dec.digitCount);
+        out += dec.digitCount;
+    } else if (dec.digitCount <= exponent + 1) {
+        // integer, possibly padded with zeros
+        memcpy(out, digits, dec.digitCount);
+        out += dec.digitCount;
+        for (int i = dec.digitCount; i <= exponent; ++i) {
+            *out++ = '0';
+        }
+    } else {
+        // ddd.ddd
+        memcpy(out, digits, exponent + 1);
+        out += exponent + 1;
+        *out++ = '.';
+        memcpy(out, digits + exponent + 1, dec.digitCount - exponent - 1);
+        out += dec.digitCount - exponent - 1;
+    }
+
+    return int(out - buffer);
+}
+
+/**
+ * Write the integer @p value to @p buffer, which must provide at least
+ * NumberBufferSize bytes. Returns the amount of characters written.
+ */
+static int formatInteger(char * buffer, qint64 value)
+{
+    char digits[NumberBufferSize];
+    int count = 0;
+    quint64 absValue = value < 0 ? 0 - quint64(value) : quint64(value);
+    do {
+        digits[count++] = char('0' + absValue % 10);
+        absValue /= 10;
+    } while (absValue);
+
+    char * out = buffer;
+    if (value < 0) {
+        *out++ = '-';
+    }
+    while (count) {
+        *out++ = digits[--count];
+    }
+    return int(out - buffer);
+}
+
+/**
+ * Format @p value with @p precision significant digits into @p buffer.
+ * The output is identical to QLocale::c().toString(value, 'g', precision),
+ * except for negative zero, but does not allocate any memory.
+ * Returns the amount of characters written.
+ */
+static inline int formatNumber(char * buffer, double value, int precision)
+{
+    return formatDecimal(buffer, quantize(value, precision), precision);
+}
+
+/**
+ * Round the @p count points @p points to @p precision significant digits
+ * in one sweep. The x and y coordinates are rounded as two separate
+ * sequences, so each reuses the exponent of its predecessor.
+ */
+static void quantizePoints(const QPointF * points, int count, int precision, QTikzQuantizedPoint * result)
+{
+    int xHint = NoExponentHint;
+    int yHint = NoExponentHint;
+    for (int i = 0; i < count; ++i) {
+        result[i].x = quantize(points[i].x(), precision, &xHint);
+        result[i].y = quantize(points[i].y(), precision, &yHint);
+    }
+}
+
+/**
+ * Returns true, if @p a and @p b denote the same rounded value.
+ */
+static inline bool isEqual(const QTikzDecimal & a, const QTikzDecimal & b)
+{
+    if (a.kind != b.kind) return false;
+    if (a.kind != QTikzDecimal::Finite) return a.negative == b.negative || a.kind == QTikzDecimal::NaN;
+    if (a.digits == 0 || b.digits == 0) return a.digits == b.digits;
+
+    return a.digits == b.digits && a.exponent == b.exponent
+        && a.digitCount == b.digitCount && a.negative == b.negative;
+}
+
+static inline bool isEqual(const QTikzQuantizedPoint & a, const QTikzQuantizedPoint & b)
+{
+    return isEqual(a.x, b.x) && isEqual(a.y, b.y);
+}
+
+/**
+ * Returns true, if the middle point @p b lies exactly on the segment from
+ * @p a to @p c, so that @p b can be dropped without changing the geometry.
+ * The test is exact on the rounded values, i.e. they are scaled to a common
+ * integer grid. If that is not possible without overflow, false is returned.
+ */
+static bool isCollinear(const QTikzQuantizedPoint & a, const QTikzQuantizedPoint & b,
+                        const QTikzQuantizedPoint & c)
+{
+    const QTikzDecimal * values[6] = { &a.x, &a.y, &b.x, &b.y, &c.x, &c.y };
+
+    // exponent of the least significant digit
+    int minExponent = INT_MAX;
+    for (int i = 0; i < 6; ++i) {
+        if (values[i]->kind != QTikzDecimal::Finite) return false;
+        if (values[i]->digits != 0) {
+            minExponent = qMin(minExponent, values[i]->exponent - values[i]->digitCount + 1);
+        }
+    }
+
+    // magnitudes are limited to 2^29, so the differences stay below 2^30
+    // and the sums of their products below 2^61, which fits a qint64
+    qint64 v[6];
+    for (int i = 0; i < 6; ++i) {
+        if (values[i]->digits == 0) {
+            v[i] = 0;
+            continue;
+        }
+        const int shift = values[i]->exponent - values[i]->digitCount + 1 - minExponent;
+        if (shift > 9) return false;
+        v[i] = values[i]->digits * s_integerPowersOfTen[shift];
+        if (v[i] > (Q_INT64_C(1) << 29)) return false;
+        if (values[i]->negative) v[i] = -v[i];
+    }
+
+    const qint64 abx = v[2] - v[0], aby = v[3] - v[1];
+    const qint64 bcx = v[4] - v[2], bcy = v[5] - v[3];
+
+    // collinear, and c continues in the direction from a to b
+    return abx * bcy == aby * bcx && abx * bcx + aby * bcy > 0;
+}
+
+/**
+ * Compute the exact difference @p a - @p b of two rounded values.
+ * Returns false, if a value is not finite or the difference does not fit
+ * into MaxSignificantDigits digits.
+ */
+static bool subtractDecimals(const QTikzDecimal & a, const QTikzDecimal & b, QTikzDecimal & result)
+{
+    if (a.kind != QTikzDecimal::Finite || b.kind != QTikzDecimal::Finite) return false;
+
+    // scale both values to the unit of the least significant digit
+    const int aUnit = a.exponent - a.digitCount + 1;
+    const int bUnit = b.exponent - b.digitCount + 1;
+    const int unit = a.digits == 0 ? bUnit : (b.digits == 0 ? aUnit : qMin(aUnit, bUnit));
+
+    qint64 v[2] = { 0, 0 };
+    const QTikzDecimal * values[2] = { &a, &b };
+    for (int i = 0; i < 2; ++i) {
+        if (values[i]->digits == 0) continue;
+        const int shift = (i == 0 ? aUnit : bUnit) - unit;
+        if (values[i]->digitCount + shift > MaxSignificantDigits) return false;
+        v[i] = values[i]->digits * s_integerPowersOfTen[shift];
+        if (values[i]->negative) v[i] = -v[i];
+    }
+
+    qint64 difference = v[0] - v[1];
+    result.kind = QTikzDecimal::Finite;
+    result.negative = difference < 0;
+    result.digits = difference < 0 ? -difference : difference;
+    result.digitCount = 1;
+    result.exponent = 0;
+    if (result.digits == 0) {
+        result.negative = false;
+        return true;
+    }
+
+    int exponent = unit;
+    while (result.digits % 10 == 0) {
+        result.digits /= 10;
+        ++exponent;
+    }
+    while (result.digitCount <= MaxSignificantDigits && result.digits >= s_integerPowersOfTen[result.digitCount]) {
+        ++result.digitCount;
+    }
+    if (result.digitCount > MaxSignificantDigits) return false;
+
+    result.exponent = exponent + result.digitCount - 1;
+    return true;
+}
+
+/**
+ * Returns the squared distance of @p p to the line segment from @p a to @p b.
+ */
+static inline qreal squaredSegmentDistance(const QPointF & p, const QPointF & a, const QPointF & b)
+{
+    const qreal dx = b.x() - a.x();
+    const qreal dy = b.y() - a.y();
+    qreal px = p.x() - a.x();
+    qreal py = p.y() - a.y();
+
+    const qreal lengthSquared = dx * dx + dy * dy;
+    if (lengthSquared > 0) {
+        const qreal t = qBound(qreal(0), (px * dx + py * dy) / lengthSquared, qreal(1));
+        px -= t * dx;
+        py -= t * dy;
+    }
+    return px * px + py * py;
+}
+
+/**
+ * Simplify the polyline @p points of size @p count with the Douglas-Peucker
+ * algorithm, i.e. remove all points that are closer than @p tolerance to
+ * the simplified polyline. The first and last point are always kept.
+ * The kept points are appended to @p result, @p keep and @p stack are
+ * scratch buffers, so that repeated calls do not allocate.
+ */
+static void simplifyPolyline(const QPointF * points, int count, qreal tolerance,
+                             QVector<QPointF> & result, QVector<char> & keep, QVector<int> & stack)
+{
+    if (count < 3) {
+        for (int i = 0; i < count; ++i) {
+            result.append(points[i]);
+        }
+        return;
+    }
+
+    const qreal toleranceSquared = tolerance * tolerance;
+    keep.fill(0, count);
+    keep[0] = keep[count - 1] = 1;
+
+    // iterative instead of recursive to handle huge inputs
+    stack.resize(0);
+    stack.append(0);
+    stack.append(count - 1);
+    while (!stack.isEmpty()) {
+        const int last = stack.last(); stack.removeLast();
+        const int first = stack.last(); stack.removeLast();
+
+        int farthest = -1;
+        qreal maxDistance = toleranceSquared;
+        for (int i = first + 1; i < last; ++i) {
+            const qreal distance = squaredSegmentDistance(points[i], points[first], points[last]);
+            if (distance > maxDistance) {
+                maxDistance = distance;
+                farthest = i;
+            }
+        }
+
+        if (farthest > 0) {
+            keep[farthest] = 1;
+            stack.append(first);
+            stack.append(farthest);
+            stack.append(farthest);
+            stack.append(last);
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (keep[i]) {
+            result.append(points[i]);
+        }
+    }
+}
+
+/**
+ * Curves flattened by QTikzPathWriter::writeFlattened() are written with
+ * at most this many line segments, more would be longer than the curve.
+ */
+static const int MaxFlatteningSegments = 3;
+
+/**
+ * Maximum number of decimals of arc angles. Smaller angles would be
+ * written in scientific notation.
+ */
+static const int MaxArcAngleDecimals = 4;
+
+/**
+ * Returns the point at @p t of the cubic curve from @p p0 to @p p3 with
+ * the control points @p p1 and @p p2.
+ */
+static inline QPointF cubicPoint(const QPointF & p0, const QPointF & p1, const QPointF & p2,
+                                 const QPointF & p3, qreal t)
+{
+    const qreal s = 1 - t;
+    return s * s * s * p0 + 3 * s * s * t * p1 + 3 * s * t * t * p2 + t * t * t * p3;
+}
+
+static inline qreal length(const QPointF & v)
+{
+    return std::hypot(v.x(), v.y());
+}
+
+static inline qreal magnitude(const QPointF & pt)
+{
+    return qMax(std::fabs(pt.x()), std::fabs(pt.y()));
+}
+
+/**
+ * Returns the rounding error of coordinates up to @p magnitude written
+ * with @p precision significant digits, i.e. half a unit in the last place.
+ */
+static qreal roundingError(qreal magnitude, int precision)
+{
+    if (!(magnitude > 0)) return 0;
+    return 0.5 * std::pow(10.0, std::floor(std::log10(magnitude)) - significantDigits(precision) + 1);
+}
+
+/**
+ * A circular arc around @p center, sweeping @p sweep radians from its
+ * start point, counterclockwise for positive values.
+ */
+struct QTikzArc
+{
+    QTikzArc() : radius(0), sweep(0) {}
+
+    QPointF center;
+    qreal radius;
+    qreal sweep;
+};
+
+/**
+ * Returns whether the cubic curve from @p p0 to @p p3 with the control
+ * points @p p1 and @p p2 deviates less than @p tolerance from a circular
+ * arc, and stores that arc in @p arc.
+ */
+static bool circularArc(const QPointF & p0, const QPointF & p1, const QPointF & p2, const QPointF & p3,
+                        qreal tolerance, QTikzArc & arc)
+{
+    const QPointF t0 = p1 - p0;
+    const QPointF t3 = p3 - p2;
+    const qreal cross = t0.x() * t3.y() - t0.y() * t3.x();
+    if (!(std::fabs(cross) > 1e-9 * length(t0) * length(t3))) return false;
+
+    // the center is the intersection of the normals at both end points,
+    // left of the tangents for counterclockwise arcs
+    const qreal s = QPointF::dotProduct(p3 - p0, t3) / cross;
+    if (s * cross <= 0) return false;
+    arc.center = p0 + s * QPointF(-t0.y(), t0.x());
+
+    const qreal r0 = length(p0 - arc.center);
+    const qreal r3 = length(p3 - arc.center);
+    if (std::fabs(r0 - r3) > tolerance) return false;
+    arc.radius = (r0 + r3) / 2;
+
+    for (int k = 1; k < 4; ++k) {
+        const QPointF pt = cubicPoint(p0, p1, p2, p3, k * qreal(0.25));
+        if (std::fabs(length(pt - arc.center) - arc.radius) > tolerance) return false;
+    }
+
+    const QPointF a = p0 - arc.center;
+    const QPointF b = p3 - arc.center;
+    arc.sweep = std::atan2(a.x() * b.y() - a.y() * b.x(), QPointF::dotProduct(a, b));
+    if (cross > 0 && arc.sweep < 0) {
+        arc.sweep += 2 * M_PI;
+    } else if (cross < 0 && arc.sweep > 0) {
+        arc.sweep -= 2 * M_PI;
+    }
+    return true;
+}
+
+/**
+ * Returns @p value rounded to @p decimals decimal places.
+ */
+static inline double roundDecimals(double value, int decimals)
+{
+    return std::floor(value * s_powersOfTen[decimals] + 0.5) / s_powersOfTen[decimals];
+}
+
+/**
+ * Write @p value, which has at most @p decimals decimal places, to
+ * @p buffer, see formatNumber().
+ */
+static int formatDecimals(char * buffer, double value, int decimals)
+{
+    if (value == 0) {
+        buffer[0] = '0';
+        return 1;
+    }
+    const int digits = int(std::floor(std::log10(std::fabs(value)))) + 1 + decimals;
+    return formatNumber(buffer, value, qMax(1, digits));
+}
+
+int QTikzColorTable::value(QRgb key) const
+{
+    const uint mask = uint(slots.size() - 1);
+    for (uint i = bucket(key); slots[i].index >= 0; i = (i + 1) & mask) {
+        if (slots[i].key == key) {
+            return slots[i].index;
+        }
+    }
+    return -1;
+}
+
+void QTikzColorTable::insert(QRgb key, int index)
+{
+    // keep the load factor below 1/2
+    if (2 * (count + 1) > slots.size()) {
+        const QVector<Slot> oldSlots = slots;
+        slots.resize(2 * slots.size());
+        --shift;
+        clear();
+        for (int i = 0; i < oldSlots.size(); ++i) {
+            if (oldSlots[i].index >= 0) {
+                insert(oldSlots[i].key, oldSlots[i].index);
+            }
+        }
+    }
+
+    const uint mask = uint(slots.size() - 1);
+    uint i = bucket(key);
+    while (slots[i].index >= 0 && slots[i].key != key) {
+        i = (i + 1) & mask;
+    }
+    if (slots[i].index < 0) {
+        ++count;
+    }
+    slots[i].key = key;
+    slots[i].index = index;
+}
+
+void QTikzColorTable::clear()
+{
+    for (int i = 0; i < slots.size(); ++i) {
+        slots[i].index = -1;
+    }
+    count = 0;
+}
+
+/**
+ * Write the TikZ identifier for the opaque color @p rgb, i.e. 'c' followed
+ * by the hex color name with digits mapped to letters ('0' = 'q', ...),
+ * to @p buffer. Returns the length of the identifier (always 7).
+ */
+static int formatColorName(char * buffer, QRgb rgb)
+{
+    buffer[0] = 'c';
+    for (int i = 0; i < 6; ++i) {
+        const int nibble = (rgb >> (20 - 4 * i)) & 0xf;
+        buffer[i + 1] = char(nibble < 10 ? 'q' + nibble : 'a' + nibble - 10);
+    }
+    return 7;
+}
+
+/**
+ * Painter paths with less elements are always serialized on the calling thread.
+ */
+static const int ParallelPathThreshold = 16384;
+
+/**
+ * Minimum amount of painter path elements serialized by a worker thread.
+ */
+static const int ParallelChunkSize = 4096;
+
+/**
+ * A range of painter path elements serialized on a worker thread,
+ * see QTikzPicturePrivate::writeShape().
+ */
+class QTikzPathChunk : public QRunnable
+{
+public:
+    QTikzPathChunk(const QTikzPathWriter & settings, const QPainterPath & painterPath, int first, int last)
+        : writer(output, 0)
+        , path(painterPath)
+        , begin(first)
+        , end(last)
+    {
+        writer.copySettings(settings);
+        setAutoDelete(false);
+    }
+
+    void run()
+    {
+        writer.writeTikzPath(path, begin, end);
+        done.release();
+    }
+
+    QByteArray output;
+    QTikzPathWriter writer;
+    const QPainterPath & path;
+    const int begin;
+    const int end;
+    QSemaphore done;
+};
+
+/**
+ * TikZ path commands, indexed by QTikzDisplayCommand::path.
+ */
+static const char * const PathCommands[] = { "\\path", "\\draw", "\\fill", "\\clip" };
+
+/**
+ * Returns the index of the path command @p cmd in PathCommands, or -1.
+ */
+static inline int pathCommandIndex(const char * cmd)
+{
+    switch (cmd[1]) {
+        case 'p': return 0;
+        case 'd': return 1;
+        case 'f': return 2;
+        case 'c': return 3;
+        default: return -1;
+    }
+}
+
+/**
+ * Returns the options of a drawing call as string.
+ */
+static inline const QString & optionString(const QString & options) { return options; }
+static inline const QString & optionString(const QTikzStyle & style) { return style.options(); }
+
+void QTikzDisplayList::clear()
+{
+    commands.clear();
+    values.clear();
+    strings.clear();
+    stringIndexes.clear();
+    texts.clear();
+}
+
+int QTikzDisplayList::addString(const QString & string)
+{
+    if (string.isEmpty()) return -1;
+
+    int & index = stringIndexes[string];
+    if (index == 0) {
+        strings.append(string);
+        index = strings.size();
+    }
+    return index - 1;
+}
+
+void QTikzDisplayList::addText(const QByteArray & text)
+{
+    // consecutive text is merged into a single command
+    if (!commands.isEmpty() && commands.last().type == QTikzDisplayCommand::Text) {
+        texts.last().append(text);
+        return;
+    }
+
+    QTikzDisplayCommand & command = addCommand(QTikzDisplayCommand::Text, PathCommands[0], QString());
+    command.string = texts.size();
+    texts.append(text);
+}
+
+QTikzDisplayCommand & QTikzDisplayList::addCommand(QTikzDisplayCommand::Type type, const char * cmd, const QString & options)
+{
+    QTikzDisplayCommand command;
+    command.type = quint8(type);
+    command.path = 0;
+    for (int i = 1; i < int(sizeof(PathCommands) / sizeof(PathCommands[0])); ++i) {
+        if (strcmp(cmd, PathCommands[i]) == 0) {
+            command.path = quint8(i);
+        }
+    }
+    command.string = addString(options);
+    command.first = values.size();
+    command.count = 0;
+
+    commands.append(command);
+    return commands.last();
+}
+
+int QTikzDisplayList::appendShape(const QRectF & rect)
+{
+    values << rect.x() << rect.y() << rect.width() << rect.height();
+    return 1;
+}
+
+int QTikzDisplayList::appendShape(const QLineF & line)
+{
+    values << line.x1() << line.y1() << line.x2() << line.y2();
+    return 1;
+}
+
+int QTikzDisplayList::appendShape(const QTikzCircle & circle)
+{
+    values << circle.center.x() << circle.center.y() << circle.radius;
+    return 1;
+}
+
+int QTikzDisplayList::appendShape(const QPolygonF & polygon)
+{
+    return appendPoints(polygon.constData(), polygon.size());
+}
+
+int QTikzDisplayList::appendShape(const QPainterPath & path)
+{
+    const int count = path.elementCount();
+    values.reserve(values.size() + 3 * count);
+    for (int i = 0; i < count; ++i) {
+        const QPainterPath::Element & element = path.elementAt(i);
+        values << double(element.type) << element.x << element.y;
+    }
+    return count;
+}
+
+int QTikzDisplayList::appendPoints(const QPointF * points, int count)
+{
+    values.reserve(values.size() + 2 * count);
+    for (int i = 0; i < count; ++i) {
+        values << points[i].x() << points[i].y();
+    }
+    return count;
+}
+
+/**
+ * Returns the geometry of the shape command @p command as painter path,
+ * where @p v are its values.
+ */
+static QPainterPath toPainterPath(const QTikzDisplayCommand & command, const double * v)
+{
+    QPainterPath path;
+    switch (command.type) {
+    case QTikzDisplayCommand::Rect:
+        for (int j = 0; j < command.count; ++j) {
+            path.addRect(QRectF(v[4 * j], v[4 * j + 1], v[4 * j + 2], v[4 * j + 3]));
+        }
+        break;
+    case QTikzDisplayCommand::Line:
+        for (int j = 0; j < command.count; ++j) {
+            path.moveTo(v[4 * j], v[4 * j + 1]);
+            path.lineTo(v[4 * j + 2], v[4 * j + 3]);
+        }
+        break;
+    case QTikzDisplayCommand::Circle:
+        for (int j = 0; j < command.count; ++j) {
+            path.addEllipse(QPointF(v[3 * j], v[3 * j + 1]), v[3 * j + 2], v[3 * j + 2]);
+        }
+        break;
+    case QTikzDisplayCommand::Polygon:
+    case QTikzDisplayCommand::Polyline:
+        for (int j = 0; j < command.count; ++j) {
+            if (j == 0) {
+                path.moveTo(v[0], v[1]);
+            } else {
+                path.lineTo(v[2 * j], v[2 * j + 1]);
+            }
+        }
+        if (command.type == QTikzDisplayCommand::Polygon) {
+            path.closeSubpath();
+        }
+        break;
+    case QTikzDisplayCommand::PainterPath:
+        for (int j = 0; j < command.count; ++j) {
+            const double * element = v + 3 * j;
+            switch (int(element[0])) {
+            case QPainterPath::MoveToElement:
+                path.moveTo(element[1], element[2]);
+                break;
+            case QPainterPath::LineToElement:
+                path.lineTo(element[1], element[2]);
+                break;
+            case QPainterPath::CurveToElement:
+                path.cubicTo(QPointF(element[1], element[2]),
+                             QPointF(element[4], element[5]),
+                             QPointF(element[7], element[8]));
+                j += 2;
+                break;
+            }
+        }
+        break;
+    }
+    return path;
+}
+
+/**
+ * Centimeters per TeX point. Coordinates without unit are centimeters
+ * in TikZ, line widths are given in points.
+ */
+static const qreal CentimetersPerPoint = 2.54 / 72.27;
+
+/**
+ * Maximum width and height in pixels of the image of a raster scope.
+ * Larger scopes are rendered with a lower resolution.
+ */
+static const int MaxRasterSize = 16384;
+
+/**
+ * How a path command of a raster scope is rendered, interpreted from its
+ * options by QTikzPicturePrivate::rasterStyle().
+ */
+struct QTikzRasterStyle
+{
+    explicit QTikzRasterStyle(int path = 0)
+        : draw(path == 1), fill(path == 2), evenOdd(false)
+        , drawColor(Qt::black), fillColor(Qt::black)
+        , lineWidth(0.4), drawOpacity(1), fillOpacity(1)
+    {}
+
+    bool draw;
+    bool fill;
+    bool evenOdd;
+    QColor drawColor;
+    QColor fillColor;
+    qreal lineWidth;    // in points
+    qreal drawOpacity;
+    qreal fillOpacity;
+};
+
+/**
+ * Names known to the options of a raster scope: the defined colors by
+ * name, and the options of each style by its name.
+ */
+struct QTikzRasterNames
+{
+    QHash<QString, QRgb> colors;
+    QHash<QString, QString> styles;
+};
+
+/**
+ * Parse the TeX length @p text into @p points. A length without unit is
+ * taken as points.
+ */
+static bool parseLength(const QString & text, qreal & points)
+{
+    static const struct { const char * unit; qreal points; } units[] = {
+        { "pt", 1 }, { "bp", 72.27 / 72 }, { "mm", 72.27 / 25.4 }, { "cm", 72.27 / 2.54 }, { "in", 72.27 }
+    };
+
+    QString number = text.trimmed();
+    qreal factor = 1;
+    for (size_t i = 0; i < sizeof(units) / sizeof(units[0]); ++i) {
+        if (number.endsWith(QLatin1String(units[i].unit))) {
+            number = number.left(number.size() - 2).trimmed();
+            factor = units[i].points;
+            break;
+        }
+    }
+
+    bool ok = false;
+    const qreal value = number.toDouble(&ok);
+    if (ok) {
+        points = value * factor;
+    }
+    return ok;
+}
+
+/**
+ * Parse the xcolor expression @p text, e.g. 'red' or 'red!50!blue', into
+ * @p color. Returns false for unknown colors.
+ */
+static bool parseColor(const QString & text, const QTikzRasterNames & names, QColor & color)
+{
+    const QStringList parts = text.trimmed().split(QLatin1Char('!'));
+    if (!names.colors.contains(parts[0])) return false;
+
+    QRgb rgb = names.colors.value(parts[0]);
+    for (int i = 1; i < parts.size(); i += 2) {
+        bool ok = false;
+        const qreal percent = qBound(qreal(0), parts[i].toDouble(&ok), qreal(100));
+        if (!ok) return false;
+
+        // mixed with white, if no second color is given
+        QRgb other = qRgb(255, 255, 255);
+        if (i + 1 < parts.size()) {
+            if (!names.colors.contains(parts[i + 1])) return false;
+            other = names.colors.value(parts[i + 1]);
+        }
+
+        const qreal t = percent / 100;
+        rgb = qRgb(qRound(qRed(rgb) * t + qRed(other) * (1 - t)),
+                   qRound(qGreen(rgb) * t + qGreen(other) * (1 - t)),
+                   qRound(qBlue(rgb) * t + qBlue(other) * (1 - t)));
+    }
+
+    color = QColor(rgb);
+    return true;
+}
+
+/**
+ * Interpret the TikZ @p options of a path command in a raster scope, see
+ * QTikzPicture::beginRasterScope() for the keys understood. The options
+ * are split at each comma, so values containing commas are not supported.
+ * Styles are expanded up to @p depth levels, unknown keys are ignored.
+ */
+static void rasterStyle(const QString & options, const QTikzRasterNames & names, QTikzRasterStyle & style, int depth)
+{
+    static const struct { const char * name; qreal points; } lineWidths[] = {
+        { "ultra thin", 0.1 }, { "very thin", 0.2 }, { "thin", 0.4 }, { "semithick", 0.6 },
+        { "thick", 0.8 }, { "very thick", 1.2 }, { "ultra thick", 1.6 }
+    };
+
+    const QStringList keys = options.split(QLatin1Char(','));
+    for (int i = 0; i < keys.size(); ++i) {
+        const int equals = keys[i].indexOf(QLatin1Char('='));
+        const QString key = (equals < 0 ? keys[i] : keys[i].left(equals)).simplified();
+        const QString value = equals < 0 ? QString() : keys[i].mid(equals + 1).trimmed();
+        if (key.isEmpty()) continue;
+
+        if (key == QLatin1String("draw") || key == QLatin1String("fill")) {
+            const bool draw = key == QLatin1String("draw");
+            (draw ? style.draw : style.fill) = value != QLatin1String("none");
+            if (!value.isEmpty()) {
+                parseColor(value, names, draw ? style.drawColor : style.fillColor);
+            }
+        } else if (key == QLatin1String("color")) {
+            if (parseColor(value, names, style.drawColor)) {
+                style.fillColor = style.drawColor;
+            }
+        } else if (key == QLatin1String("opacity")) {
+            style.drawOpacity = style.fillOpacity = value.toDouble();
+        } else if (key == QLatin1String("draw opacity")) {
+            style.drawOpacity = value.toDouble();
+        } else if (key == QLatin1String("fill opacity")) {
+            style.fillOpacity = value.toDouble();
+        } else if (key == QLatin1String("line width")) {
+            parseLength(value, style.lineWidth);
+        } else if (key == QLatin1String("even odd rule")) {
+            style.evenOdd = true;
+        } else if (key == QLatin1String("nonzero rule")) {
+            style.evenOdd = false;
+        } else if (equals < 0) {
+            bool known = false;
+            for (size_t j = 0; j < sizeof(lineWidths) / sizeof(lineWidths[0]) && !known; ++j) {
+                if (key == QLatin1String(lineWidths[j].name)) {
+                    style.lineWidth = lineWidths[j].points;
+                    known = true;
+                }
+            }
+            if (!known && names.styles.contains(key)) {
+                if (depth > 0) {
+                    rasterStyle(names.styles.value(key), names, style, depth - 1);
+                }
+            } else if (!known && parseColor(key, names, style.drawColor)) {
+                // a color name without key sets the color of both
+                style.fillColor = style.drawColor;
+            }
+        }
+    }
+}
+
+/**
+ * Encodes the image of a raster scope as PNG on a worker thread.
+ */
+class QTikzImageWriter : public QRunnable
+{
+public:
+    QTikzImageWriter(const QImage & rasterImage, const QString & imageFileName)
+        : image(rasterImage)
+        , fileName(imageFileName)
+    {
+    }
+
+    void run()
+    {
+        if (!image.save(fileName, "PNG")) {
+            qWarning() << "QTikzPicture: cannot write image" << fileName;
+        }
+    }
+
+    const QImage image;
+    const QString fileName;
+};
+
+/**
+ * Identifies the data of QTikzPicture::saveState(), followed by its version.
+ */
+static const quint32 StateMagic = 0x51545a53;
+static const qint32 StateVersion = 2;
+
+/**
+ * The state of a picture needed to continue its output, see
+ * QTikzPicture::saveState().
+ */
+struct QTikzPictureState
+{
+    QTikzPictureState() : outputOffset(0), styleCount(0), scopeDepth(0), traceDepth(0), rasterCount(0) {}
+
+    void write(QDataStream & out) const;
+    bool read(QDataStream & in);
+
+    qint64 outputOffset;
+
+    QVector<QString> colorNames;
+    QTikzColorTable colorTable;
+    QVector<QRgb> paletteColors;
+    QVector<int> paletteIndexes;
+
+    QHash<QString, QTikzOptionEntry> optionTable;
+    QVector<QString> styleStack;
+    int styleCount;
+    int scopeDepth;
+    int traceDepth;
+    int rasterCount;
+
+    QTikzBounds clipBounds;
+    QVector<QTikzBounds> clipStack;
+
+    QHash<QString, QTikzSymbol> symbols;
+    QVector<QString> symbolStack;
+};
+
+static QDataStream & operator<<(QDataStream & out, const QTikzBounds & bounds)
+{
+    return out << bounds.left << bounds.top << bounds.right << bounds.bottom;
+}
+
+static QDataStream & operator>>(QDataStream & in, QTikzBounds & bounds)
+{
+    return in >> bounds.left >> bounds.top >> bounds.right >> bounds.bottom;
+}
+
+void QTikzPictureState::write(QDataStream & out) const
+{
+    out << StateMagic << StateVersion << outputOffset;
+
+    QVector<QRgb> colorKeys;
+    QVector<int> colorIndexes;
+    colorTable.forEach([&](QRgb key, int index) {
+        colorKeys.append(key);
+        colorIndexes.append(index);
+    });
+    out << colorNames << colorKeys << colorIndexes << paletteColors << paletteIndexes;
+
+    out << qint32(optionTable.size());
+    for (auto it = optionTable.constBegin(); it != optionTable.constEnd(); ++it) {
+        out << it.key() << qint32(it.value().count) << qint32(it.value().depth) << it.value().style;
+    }
+    out << styleStack << qint32(styleCount) << qint32(scopeDepth) << qint32(traceDepth) << qint32(rasterCount);
+
+    out << clipBounds << qint32(clipStack.size());
+    for (int i = 0; i < clipStack.size(); ++i) {
+        out << clipStack[i];
+    }
+
+    out << qint32(symbols.size());
+    for (auto it = symbols.constBegin(); it != symbols.constEnd(); ++it) {
+        const QTikzSymbol & symbol = it.value();
+        out << it.key() << symbol.path << symbol.options << symbol.bounds << qint32(symbol.depth);
+    }
+    out << symbolStack;
+}
+
+bool QTikzPictureState::read(QDataStream & in)
+{
+    quint32 magic = 0;
+    qint32 version = 0;
+    in >> magic >> version;
+    if (magic != StateMagic || version != StateVersion) return false;
+    in >> outputOffset;
+
+    QVector<QRgb> colorKeys;
+    QVector<int> colorIndexes;
+    in >> colorNames >> colorKeys >> colorIndexes >> paletteColors >> paletteIndexes;
+    if (colorKeys.size() != colorIndexes.size() || paletteColors.size() != paletteIndexes.size()) return false;
+    for (int i = 0; i < colorKeys.size(); ++i) {
+        if (colorIndexes[i] < 0 || colorIndexes[i] >= colorNames.size()) return false;
+        colorTable.insert(colorKeys[i], colorIndexes[i]);
+    }
+
+    qint32 count = 0;
+    in >> count;
+    for (int i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QString options;
+        qint32 uses = 0;
+        qint32 depth = -1;
+        QTikzOptionEntry entry;
+        in >> options >> uses >> depth >> entry.style;
+        entry.count = uses;
+        entry.depth = depth;
+        optionTable.insert(options, entry);
+    }
+
+    qint32 styles = 0;
+    qint32 depth = 0;
+    qint32 traces = 0;
+    qint32 rasters = 0;
+    in >> styleStack >> styles >> depth >> traces >> rasters;
+    styleCount = styles;
+    scopeDepth = depth;
+    traceDepth = traces;
+    rasterCount = rasters;
+
+    in >> clipBounds >> count;
+    for (int i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QTikzBounds bounds;
+        in >> bounds;
+        clipStack.append(bounds);
+    }
+
+    in >> count;
+    for (int i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QString name;
+        QTikzSymbol symbol;
+        qint32 symbolDepth = -1;
+        in >> name >> symbol.path >> symbol.options >> symbol.bounds >> symbolDepth;
+        symbol.depth = symbolDepth;
+        symbols.insert(name, symbol);
+    }
+    in >> symbolStack;
+
+    return in.status() == QDataStream::Ok && outputOffset >= 0;
+}
+
+QTikzPicturePrivate::~QTikzPicturePrivate()
+{
+    // waits for the worker and for the images still being encoded
+    delete async;
+    delete imagePool;
+    delete threadPool;
+    delete compressor;
+    if (rasterList) {
+        delete rasterList;
+        displayList = rasterOuterList;
+    }
+    delete displayList;
+}
+
+/**
+ * Accounts the time of a drawing call to QTikzStats::formatTime, except
+ * the time spent in the sink, which flush() accounts to writeTime.
+ * Nested calls are accounted by the outermost timer only.
+ */
+class QTikzStatsTimer
+{
+public:
+    explicit QTikzStatsTimer(QTikzPicturePrivate * owner)
+        : d(owner->statsEnabled && !owner->timing ? owner : 0)
+        , writeTime(0)
+    {
+        if (d) {
+            d->timing = true;
+            writeTime = d->stats.writeTime;
+            timer.start();
+        }
+    }
+
+    ~QTikzStatsTimer()
+    {
+        if (d) {
+            d->stats.formatTime += timer.nsecsElapsed() - (d->stats.writeTime - writeTime);
+            d->timing = false;
+        }
+    }
+
+private:
+    QTikzPicturePrivate * d;
+    qint64 writeTime;
+    QElapsedTimer timer;
+};
+
+int QTikzPathWriter::toCoord(char * buffer, const QPointF & pt) const
+{
+    char * out = buffer;
+    *out++ = '(';
+    out += formatDecimal(out, ::quantize(pt.x(), precision, &xExponentHint), precision);
+    *out++ = ',';
+    if (!compact) {
+        *out++ = ' ';
+    }
+    out += formatDecimal(out, ::quantize(pt.y(), precision, &yExponentHint), precision);
+    *out++ = ')';
+    return int(out - buffer);
+}
+
+int QTikzPathWriter::toCoord(char * buffer, const QTikzQuantizedPoint & pt) const
+{
+    char * out = buffer;
+    *out++ = '(';
+    out += formatDecimal(out, pt.x, precision);
+    *out++ = ',';
+    if (!compact) {
+        *out++ = ' ';
+    }
+    out += formatDecimal(out, pt.y, precision);
+    *out++ = ')';
+    return int(out - buffer);
+}
+
+QTikzQuantizedPoint QTikzPathWriter::quantize(const QPointF & pt) const
+{
+    QTikzQuantizedPoint q;
+    q.x = ::quantize(pt.x(), precision, &xExponentHint);
+    q.y = ::quantize(pt.y(), precision, &yExponentHint);
+    return q;
+}
+
+QTikzPathWriter::QTikzPathWriter(QByteArray & outputBuffer, QTikzPicturePrivate * outputOwner)
+    : buffer(outputBuffer)
+    , owner(outputOwner)
+    , precision(2)
+    , xExponentHint(NoExponentHint)
+    , yExponentHint(NoExponentHint)
+    , simplifyTolerance(0)
+    , redundantPointRemoval(false)
+    , hasPendingPoint(false)
+    , compact(false)
+    , relativePoints(0)
+    , arcDetection(false)
+    , flatteningTolerance(0)
+{
+}
+
+void QTikzPathWriter::copySettings(const QTikzPathWriter & other)
+{
+    precision = other.precision;
+    simplifyTolerance = other.simplifyTolerance;
+    redundantPointRemoval = other.redundantPointRemoval;
+    compact = other.compact;
+    arcDetection = other.arcDetection;
+    flatteningTolerance = other.flatteningTolerance;
+}
+
+void QTikzPathWriter::write(const char * text)
+{
+    write(text, int(strlen(text)));
+}
+
+void QTikzPathWriter::write(const QString & text)
+{
+    // options and styles are almost always ASCII, which is encoded in
+    // place instead of through a temporary QByteArray
+    const int size = text.size();
+    const ushort * utf16 = text.utf16();
+    const int offset = buffer.size();
+    buffer.resize(offset + size);
+    char * out = buffer.data() + offset;
+    for (int i = 0; i < size; ++i) {
+        if (utf16[i] >= 0x80) {
+            buffer.resize(offset);
+            const QByteArray utf8 = text.toUtf8();
+            write(utf8.constData(), utf8.size());
+            return;
+        }
+        out[i] = char(utf16[i]);
+    }
+
+    if (owner && buffer.size() >= owner->bufferSize) {
+        owner->flush();
+    }
+}
+
+void QTikzPathWriter::write(QLatin1String text)
+{
+    for (int i = 0; i < text.size(); ++i) {
+        if (uchar(text.data()[i]) >= 0x80) {
+            write(QString(text));
+            return;
+        }
+    }
+    write(text.data(), text.size());
+}
+
+void QTikzPathWriter::writeNumber(double number)
+{
+    char buffer[NumberBufferSize];
+    write(buffer, formatNumber(buffer, number, precision));
+}
+
+void QTikzPicturePrivate::write(const char * text) { writer.write(text); }
+void QTikzPicturePrivate::write(const QString & text) { writer.write(text); }
+void QTikzPicturePrivate::write(QLatin1String text) { writer.write(text); }
+void QTikzPicturePrivate::writeNumber(double number) { writer.writeNumber(number); }
+
+void QTikzPathWriter::writeCoord(const QPointF & pt)
+{
+    char buffer[CoordBufferSize];
+    write(buffer, toCoord(buffer, pt));
+}
+
+void QTikzPathWriter::writeCoord(const QTikzQuantizedPoint & pt)
+{
+    char buffer[CoordBufferSize];
+    write(buffer, toCoord(buffer, pt));
+}
+
+/**
+ * Write the first point of a polyline. The following points are written
+ * with writeLineTo(), and the polyline is finished with flushLineTo().
+ */
+void QTikzPathWriter::writeStartPoint(const QPointF & pt)
+{
+    writeStartPoint(quantize(pt));
+}
+
+void QTikzPathWriter::writeStartPoint(const QTikzQuantizedPoint & pt)
+{
+    flushLineTo();
+    anchorPoint = pt;
+    relativePoints = 0;
+    writeCoord(anchorPoint);
+}
+
+void QTikzPathWriter::writeLineTo(const QPointF & pt)
+{
+    if (!redundantPointRemoval) {
+        writeLineToCoord(quantize(pt));
+        return;
+    }
+
+    addLineTo(pt);
+}
+
+/**
+ * Write a line segment from the last written point to @p pt. In compact
+ * output, @p pt is written relative to the last point whenever that is
+ * shorter. The difference is computed exactly on the rounded values, so
+ * the point TeX arrives at is the same as for the absolute coordinate.
+ */
+void QTikzPathWriter::writeLineToCoord(const QTikzQuantizedPoint & pt)
+{
+    if (!compact) {
+        write(" -- ");
+        writeCoord(pt);
+        anchorPoint = pt;
+        return;
+    }
+
+    char buffer[CoordBufferSize + 2];
+    memcpy(buffer, "--", 2);
+    int size = toCoord(buffer + 2, pt);
+
+    QTikzQuantizedPoint delta;
+    if (relativePoints < RelativeAnchorInterval
+        && subtractDecimals(pt.x, anchorPoint.x, delta.x)
+        && subtractDecimals(pt.y, anchorPoint.y, delta.y))
+    {
+        char relative[CoordBufferSize + 4];
+        memcpy(relative, "--++", 4);
+        const int relativeSize = toCoord(relative + 4, delta);
+        if (relativeSize + 2 < size) {
+            write(relative, relativeSize + 4);
+            anchorPoint = pt;
+            ++relativePoints;
+            return;
+        }
+    }
+
+    write(buffer, size + 2);
+    anchorPoint = pt;
+    relativePoints = 0;
+}
+
+/**
+ * Close the current subpath with a line to its start point.
+ */
+void QTikzPathWriter::writeCycle()
+{
+    write(compact ? "--cycle" : " -- cycle");
+
+    // the current point is the start of the subpath now, which is not
+    // tracked, so the next point must not be written relative
+    relativePoints = RelativeAnchorInterval;
+}
+
+/**
+ * Separate two subpaths. The readable output starts each subpath on a
+ * new, indented line.
+ */
+void QTikzPathWriter::writeSubpathSeparator()
+{
+    write(compact ? " " : "\n    ");
+}
+
+/**
+ * Add @p pt to the current polyline, dropping points that are identical
+ * to the previous one after rounding, and merging collinear segments.
+ * The last point is kept back until it is known whether it can be merged.
+ */
+void QTikzPathWriter::addLineTo(const QPointF & pt)
+{
+    addLineTo(quantize(pt));
+}
+
+void QTikzPathWriter::addLineTo(const QTikzQuantizedPoint & q)
+{
+    if (isEqual(q, hasPendingPoint ? pendingPoint : anchorPoint)) {
+        return;
+    }
+
+    if (hasPendingPoint && !isCollinear(anchorPoint, pendingPoint, q)) {
+        writeLineToCoord(pendingPoint);
+    }
+
+    pendingPoint = q;
+    hasPendingPoint = true;
+}
+
+void QTikzPathWriter::flushLineTo()
+{
+    if (hasPendingPoint) {
+        writeLineToCoord(pendingPoint);
+        hasPendingPoint = false;
+    }
+}
+
+/**
+ * Returns @p points simplified according to simplifyTolerance. @p count
+ * is updated to the size of the returned point array, which is either
+ * @p points itself or a buffer valid until the next call.
+ */
+const QPointF * QTikzPathWriter::simplified(const QPointF * points, int & count)
+{
+    if (simplifyTolerance <= 0 || count < 3) return points;
+
+    simplifyBuffer.resize(0);
+    simplifyPolyline(points, count, simplifyTolerance, simplifyBuffer, keepBuffer, rangeStack);
+    count = simplifyBuffer.size();
+    return simplifyBuffer.constData();
+}
+
+void QTikzPathWriter::writePolyline(const QPointF * points, int count)
+{
+    const QPointF * simplifiedPoints = simplified(points, count);
+
+    // round block by block, then write from the rounded integers only
+    quantizeBuffer.resize(QuantizeBlockSize);
+    QTikzQuantizedPoint * quantized = quantizeBuffer.data();
+    for (int begin = 0; begin < count; begin += QuantizeBlockSize) {
+        const int size = qMin(QuantizeBlockSize, count - begin);
+        quantizePoints(simplifiedPoints + begin, size, precision, quantized);
+
+        for (int i = 0; i < size; ++i) {
+            if (begin + i == 0) {
+                writeStartPoint(quantized[i]);
+            } else if (redundantPointRemoval) {
+                addLineTo(quantized[i]);
+            } else {
+                writeLineToCoord(quantized[i]);
+            }
+        }
+    }
+    flushLineTo();
+}
+
+void QTikzPathWriter::writeTikzPath(const QPainterPath & path)
+{
+    writeTikzPath(path, 0, path.elementCount());
+}
+
+/**
+ * Write the elements @p begin to @p end (exclusive) of @p path. The range
+ * must start with a MoveToElement. As the output of a subpath does not
+ * depend on any other subpath, ranges can be written independently.
+ */
+void QTikzPathWriter::writeTikzPath(const QPainterPath & path, int begin, int end)
+{
+    const int count = path.elementCount();
+    int subpathStart = begin;
+    int currentControlPoint = 0;
+
+    // stream the QPainterPath element by element as TikZ path
+    for (int i = begin; i < end; i++) {
+        // simplify runs of lines, this writes all but the last point of the run
+        if (simplifyTolerance > 0 && path.elementAt(i).isLineTo()) {
+            int runEnd = i + 1;
+            while (runEnd < count && path.elementAt(runEnd).isLineTo()) {
+                ++runEnd;
+            }
+            if (runEnd - i > 1) {
+                runBuffer.resize(0);
+                for (int j = i - 1; j < runEnd; ++j) {
+                    runBuffer.append(path.elementAt(j));
+                }
+                int size = runBuffer.size();
+                const QPointF * points = simplified(runBuffer.constData(), size);
+                for (int j = 1; j < size - 1; ++j) {
+                    writeLineTo(points[j]);
+                }
+                i = runEnd - 1;
+            }
+        }
+
+        const QPainterPath::Element & element = path.elementAt(i);
+
+        // a subpath ending in its start point is closed with 'cycle'
+        const bool closesSubpath = (i + 1 == count || path.elementAt(i + 1).isMoveTo())
+            && element.x == path.elementAt(subpathStart).x
+            && element.y == path.elementAt(subpathStart).y;
+
+        if (element.type != QPainterPath::LineToElement || closesSubpath) {
+            flushLineTo();
+        }
+
+        switch (element.type) {
+            case QPainterPath::MoveToElement: {
+                if (i > 0) {
+                    writeSubpathSeparator();
+                }
+                subpathStart = i;
+                const int next = arcDetection ? writeEllipse(path, i, end) : i;
+                if (next > i) {
+                    i = next - 1;
+                    break;
+                }
+                writeStartPoint(element);
+                break;
+            }
+            case QPainterPath::LineToElement: {
+                if (closesSubpath) {
+                    writeCycle();
+                } else {
+                    writeLineTo(element);
+                }
+                break;
+            }
+            case QPainterPath::CurveToElement: {
+                int next = arcDetection ? writeArc(path, i, end, subpathStart) : i;
+                if (next == i && flatteningTolerance > 0) {
+                    next = writeFlattened(path, i, subpathStart);
+                }
+                if (next > i) {
+                    i = next - 1;
+                    break;
+                }
+                write(" .. controls ");
+                writeCoord(element);
+                currentControlPoint = 1;
+                break;
+            }
+            case QPainterPath::CurveToDataElement: {
+                if (currentControlPoint == 1) {
+                    write(" and ");
+                    writeCoord(element);
+                    ++currentControlPoint;
+                } else if (currentControlPoint == 2) {
+                    if (closesSubpath) {
+                        write(" .. cycle");
+                    } else {
+                        write(" .. ");
+                        writeStartPoint(element);
+                    }
+                    currentControlPoint = 0;
+                }
+                break;
+            }
+        }
+    }
+    flushLineTo();
+}
+
+/**
+ * Write the subpath starting at element @p begin of @p path as circle or
+ * ellipse, if it consists of four curves approximating a whole circle or
+ * an axis-aligned ellipse counterclockwise, like in TikZ. Returns the
+ * index after the subpath, or @p begin if it was not written.
+ */
+int QTikzPathWriter::writeEllipse(const QPainterPath & path, int begin, int end)
+{
+    const int next = begin + 13;
+    if (next > end || (next < end && !path.elementAt(next).isMoveTo())) return begin;
+
+    QPointF points[13];
+    qreal extent = 0;
+    for (int i = 0; i < 13; ++i) {
+        const QPainterPath::Element & element = path.elementAt(begin + i);
+        if (i > 0 && element.type != (i % 3 == 1 ? QPainterPath::CurveToElement
+                                                 : QPainterPath::CurveToDataElement)) {
+            return begin;
+        }
+        points[i] = element;
+        extent = qMax(extent, magnitude(points[i]));
+    }
+    if (points[12] != points[0]) return begin;
+
+    // a circle, i.e. four arcs on the same circle
+    const qreal tolerance = roundingError(extent, precision);
+    QTikzArc circle;
+    bool isCircle = true;
+    qreal sweep = 0;
+    for (int i = 0; i < 4 && isCircle; ++i) {
+        const QPointF * p = points + 3 * i;
+        QTikzArc arc;
+        isCircle = circularArc(p[0], p[1], p[2], p[3], tolerance, arc)
+                && (i == 0 || (length(arc.center - circle.center) <= tolerance
+                               && std::fabs(arc.radius - circle.radius) <= tolerance));
+        if (i == 0) {
+            circle = arc;
+        }
+        sweep += arc.sweep;
+    }
+    if (isCircle && std::fabs(sweep - 2 * M_PI) < 1e-6) {
+        writeCoord(circle.center);
+        write(" circle (");
+        writeNumber(circle.radius);
+        write("cm)");
+        return next;
+    }
+
+    // an axis-aligned ellipse with its vertices at the ends of the curves
+    const QPointF center = (points[0] + points[6]) * 0.5;
+    const QPointF a = points[0] - center;
+    const QPointF b = points[3] - center;
+    const qreal rx = qMax(std::fabs(a.x()), std::fabs(b.x()));
+    const qreal ry = qMax(std::fabs(a.y()), std::fabs(b.y()));
+    if (magnitude((points[3] + points[9]) * 0.5 - center) > tolerance
+        || qMin(std::fabs(a.x()), std::fabs(b.x())) > tolerance
+        || qMin(std::fabs(a.y()), std::fabs(b.y())) > tolerance
+        || qMin(rx, ry) <= tolerance || a.x() * b.y() - a.y() * b.x() <= 0) {
+        return begin;
+    }
+    for (int i = 0; i < 4; ++i) {
+        const QPointF * p = points + 3 * i;
+
+        // the tangents at the vertices are parallel to the axes
+        const bool horizontal = std::fabs(p[0].y() - center.y()) <= tolerance;
+        if (horizontal ? std::fabs(p[1].x() - p[0].x()) > tolerance || std::fabs(p[2].y() - p[3].y()) > tolerance
+                       : std::fabs(p[1].y() - p[0].y()) > tolerance || std::fabs(p[2].x() - p[3].x()) > tolerance) {
+            return begin;
+        }
+        for (int k = 1; k < 4; ++k) {
+            const QPointF pt = cubicPoint(p[0], p[1], p[2], p[3], k * qreal(0.25)) - center;
+            const qreal distance = std::hypot(pt.x() / rx, pt.y() / ry) - 1;
+            if (std::fabs(distance) * qMin(rx, ry) > tolerance) return begin;
+        }
+    }
+
+    writeCoord(center);
+    write(" ellipse (");
+    writeNumber(rx);
+    write("cm and ");
+    writeNumber(ry);
+    write("cm)");
+    return next;
+}
+
+/**
+ * Write the cubic curves starting at element @p begin of @p path as a
+ * single arc, if they approximate an arc of one circle. Returns the index
+ * after the last curve written, or @p begin if nothing was written.
+ */
+int QTikzPathWriter::writeArc(const QPainterPath & path, int begin, int end, int subpathStart)
+{
+    const QPointF start = path.elementAt(begin - 1);
+    QTikzArc arc;
+    qreal extent = magnitude(start);
+    int next = begin;
+    QPointF last = start;
+    while (next + 2 < end && path.elementAt(next).isCurveTo()) {
+        const QPointF p1 = path.elementAt(next);
+        const QPointF p2 = path.elementAt(next + 1);
+        const QPointF p3 = path.elementAt(next + 2);
+        const qreal segmentExtent = qMax(extent, magnitude(p3));
+
+        QTikzArc segment;
+        if (!circularArc(last, p1, p2, p3, roundingError(segmentExtent, precision), segment)) break;
+        if (next > begin) {
+            const qreal tolerance = roundingError(qMax(segmentExtent, arc.radius), precision);
+            if (length(segment.center - arc.center) > tolerance
+                || std::fabs(segment.radius - arc.radius) > tolerance
+                || (segment.sweep > 0) != (arc.sweep > 0)
+                || std::fabs(arc.sweep + segment.sweep) > 2 * M_PI + 1e-9) {
+                break;
+            }
+            arc.sweep += segment.sweep;
+        } else {
+            arc = segment;
+        }
+        extent = segmentExtent;
+        last = p3;
+        next += 3;
+    }
+    if (next == begin) return begin;
+
+    // the rounded angles and radius must lead TikZ to the end point
+    const qreal tolerance = roundingError(qMax(extent, arc.radius), precision);
+    const QPointF a = start - arc.center;
+    const double startAngle = std::atan2(a.y(), a.x()) * 180 / M_PI;
+    const double endAngle = startAngle + arc.sweep * 180 / M_PI;
+    for (int radiusPrecision = precision; radiusPrecision <= precision + 2; ++radiusPrecision) {
+        const QTikzDecimal radius = ::quantize(arc.radius, radiusPrecision);
+        const double r = radius.digits * std::pow(10.0, radius.exponent - radius.digitCount + 1);
+        for (int decimals = 0; decimals <= MaxArcAngleDecimals; ++decimals) {
+            const double from = roundDecimals(startAngle, decimals);
+            const double to = roundDecimals(endAngle, decimals);
+            const QPointF target = start + r * QPointF(std::cos(to * M_PI / 180) - std::cos(from * M_PI / 180),
+                                                       std::sin(to * M_PI / 180) - std::sin(from * M_PI / 180));
+            if (magnitude(target - last) > tolerance) continue;
+
+            char buffer[NumberBufferSize];
+            write(compact ? "arc(" : " arc (");
+            write(buffer, formatDecimals(buffer, from, decimals));
+            write(":");
+            write(buffer, formatDecimals(buffer, to, decimals));
+            write(":");
+            write(buffer, formatDecimal(buffer, radius, radiusPrecision));
+            write("cm)");
+
+            // TikZ ends up close to, but not exactly at the rounded end point
+            anchorPoint = quantize(last);
+            relativePoints = RelativeAnchorInterval;
+            if ((next == path.elementCount() || path.elementAt(next).isMoveTo())
+                && last == QPointF(path.elementAt(subpathStart))) {
+                writeCycle();
+            }
+            return next;
+        }
+    }
+    return begin;
+}
+
+/**
+ * Write the cubic curve starting at element @p begin of @p path as short
+ * polyline, if that deviates less than flatteningTolerance from it.
+ * Returns the index after the curve, or @p begin if it was not written.
+ */
+int QTikzPathWriter::writeFlattened(const QPainterPath & path, int begin, int subpathStart)
+{
+    const QPointF p0 = path.elementAt(begin - 1);
+    const QPointF p1 = path.elementAt(begin);
+    const QPointF p2 = path.elementAt(begin + 1);
+    const QPointF p3 = path.elementAt(begin + 2);
+
+    // the distance of a cubic curve to the polyline through n points on it
+    // is at most 3/4 * max|p[i] - 2 p[i+1] + p[i+2]| / n^2
+    const qreal curvature = qMax(length(p0 - 2 * p1 + p2), length(p1 - 2 * p2 + p3));
+    const int segments = qMax(1, int(std::ceil(std::sqrt(0.75 * curvature / flatteningTolerance))));
+    if (segments > MaxFlatteningSegments) return begin;
+
+    for (int k = 1; k < segments; ++k) {
+        writeLineTo(cubicPoint(p0, p1, p2, p3, qreal(k) / segments));
+    }
+    const int next = begin + 3;
+    if ((next == path.elementCount() || path.elementAt(next).isMoveTo())
+        && p3 == QPointF(path.elementAt(subpathStart))) {
+        flushLineTo();
+        writeCycle();
+    } else {
+        writeLineTo(p3);
+    }
+    return next;
+}
+
+void QTikzPathWriter::writeTikzPath(const QPolygonF & polygon)
+{
+    // polygons are always closed, so skip an explicit closing point
+    const int size = qMax(1, polygon.isClosed() ? polygon.size() - 1 : polygon.size());
+    writePolyline(polygon.constData(), size);
+    writeCycle();
+}
+
+void QTikzPathWriter::writeTikzPath(const QRectF & rect)
+{
+    writeCoord(rect.topLeft());
+    write(" rectangle ");
+    writeCoord(rect.bottomRight());
+}
+
+void QTikzPathWriter::writeTikzPath(const QLineF & line)
+{
+    writeStartPoint(quantize(line.p1()));
+    writeLineToCoord(quantize(line.p2()));
+}
+
+void QTikzPathWriter::writeTikzPath(const QTikzCircle & circle)
+{
+    writeCoord(circle.center);
+    write(" circle (");
+    writeNumber(circle.radius);
+    write("cm)");
+}
+
+bool QTikzPicturePrivate::hasSink() const
+{
+    return ts || device || writeFunction || displayList;
+}
+
+void QTikzPicturePrivate::setSink(QTextStream * textStream, QIODevice * outputDevice,
+                                  const QTikzPicture::WriteFunction & function, int prec)
+{
+    // hand out pending output to the old sink first
+    flush();
+    delete compressor;
+    compressor = 0;
+
+    ts = textStream;
+    device = outputDevice;
+    writeFunction = function;
+    outputOffset = device ? device->pos() : 0;
+    writer.precision = qMax(0, prec);
+}
+
+void QTikzPicturePrivate::flush()
+{
+    if (buffer.isEmpty()) return;
+
+    if (displayList) {
+        // recorded as text, in order with the other commands
+        displayList->addText(buffer);
+        buffer.resize(0);
+        return;
+    }
+
+    QElapsedTimer timer;
+    if (statsEnabled) {
+        stats.bytes += buffer.size();
+        timer.start();
+    }
+
+    outputOffset += buffer.size();
+    if (ts) {
+        (*ts) << QString::fromUtf8(buffer.constData(), buffer.size());
+    } else if (device) {
+        if (device->write(buffer.constData(), buffer.size()) != buffer.size()) {
+            qWarning() << "QTikzPicture: cannot write output";
+        }
+    } else if (writeFunction) {
+        writeFunction(buffer.constData(), size_t(buffer.size()));
+    }
+
+    if (statsEnabled) {
+        stats.writeTime += timer.nsecsElapsed();
+    }
+
+    // keeps the reserved capacity
+    buffer.resize(0);
+}
+
+/**
+ * Write @p path, splitting large paths at their subpaths into chunks that
+ * are serialized in parallel. The output is identical to the serial output.
+ */
+void QTikzPicturePrivate::writeShape(const QPainterPath & path)
+{
+    if (!pathCache) {
+        writeShape(path, 0);
+        return;
+    }
+
+    QTikzPathCachePrivate * cache = pathCache->d;
+    const quint64 key = pathFingerprint(path, writer);
+    QByteArray output;
+    {
+        QMutexLocker locker(&cache->mutex);
+        const QTikzCachedPath * cached = cache->paths.object(key);
+        if (cached && cached->matches(path, writer)) {
+            output = cached->output;
+        }
+    }
+    if (!output.isEmpty()) {
+        write(output.constData(), output.size());
+        return;
+    }
+
+    // convert without holding the lock, other pictures may do the same
+    QTikzCachedPath * cached = new QTikzCachedPath(path, writer);
+    writeShape(path, &cached->output);
+    write(cached->output.constData(), cached->output.size());
+
+    QMutexLocker locker(&cache->mutex);
+    cache->paths.insert(key, cached, cached->output.size());
+}
+
+/**
+ * Write @p path, or append it to @p output if that is not 0.
+ */
+void QTikzPicturePrivate::writeShape(const QPainterPath & path, QByteArray * output)
+{
+    const int count = path.elementCount();
+    const int threads = threadCount > 0 ? threadCount : QThread::idealThreadCount();
+    if (threads < 2 || count < ParallelPathThreshold) {
+        if (output) {
+            QTikzPathWriter pathWriter(*output, 0);
+            pathWriter.copySettings(writer);
+            pathWriter.writeTikzPath(path);
+        } else {
+            writer.writeTikzPath(path);
+        }
+        return;
+    }
+
+    // split into chunks at MoveToElements
+    const int chunkSize = qMax(ParallelChunkSize, count / (4 * threads));
+    QVector<QTikzPathChunk *> chunks;
+    int begin = 0;
+    for (int i = 1; i <= count; ++i) {
+        if (i == count || (i - begin >= chunkSize && path.elementAt(i).isMoveTo())) {
+            chunks.append(new QTikzPathChunk(writer, path, begin, i));
+            begin = i;
+        }
+    }
+
+    if (!threadPool) {
+        threadPool = new QThreadPool();
+    }
+    threadPool->setMaxThreadCount(threads);
+
+    // keep a bounded amount of chunks in flight to limit the memory use,
+    // and serialize the first chunk on the calling thread
+    const int window = 2 * threads;
+    for (int i = 1; i < qMin(window, chunks.size()); ++i) {
+        threadPool->start(chunks[i]);
+    }
+    chunks[0]->run();
+
+    // write the chunks in their original order
+    for (int i = 0; i < chunks.size(); ++i) {
+        chunks[i]->done.acquire();
+        if (output) {
+            output->append(chunks[i]->output);
+        } else {
+            write(chunks[i]->output.constData(), chunks[i]->output.size());
+        }
+        chunks[i]->output.clear();
+
+        if (i + window < chunks.size()) {
+            threadPool->start(chunks[i + window]);
+        }
+    }
+
+    threadPool->waitForDone();
+    qDeleteAll(chunks);
+}
+
+void QTikzPicturePrivate::addPredefinedColor(QRgb rgb, const char * name)
+{
+    colorNames.append(QLatin1String(name));
+    colorTable.insert(rgb, colorNames.size() - 1);
+    paletteColors.append(rgb);
+    paletteIndexes.append(colorNames.size() - 1);
+}
+
+void QTikzPicturePrivate::writeColorDefinition(const char * name, int size, QRgb rgb)
+{
+    write("\\definecolor{");
+    write(name, size);
+    write("}{rgb}{");
+    writeNumber(qRed(rgb) / 255.0);
+    write(", ");
+    writeNumber(qGreen(rgb) / 255.0);
+    write(", ");
+    writeNumber(qBlue(rgb) / 255.0);
+    write("}\n");
+}
+
+/**
+ * Write the definition of a new color, or record it in retained mode.
+ */
+void QTikzPicturePrivate::defineColor(const char * name, int size, QRgb rgb)
+{
+    if (displayList) {
+        // written with the precision of the replay
+        QTikzDisplayCommand & command = record(QTikzDisplayCommand::Color, PathCommands[0], QLatin1String(name, size));
+        command.first = int(rgb);
+    } else if (hasSink()) {
+        writeColorDefinition(name, size, rgb);
+        sync();
+    }
+}
+
+/**
+ * Returns the index of the defined color nearest to @p rgb within
+ * colorTolerance, or -1.
+ */
+int QTikzPicturePrivate::nearestColor(QRgb rgb) const
+{
+    int nearest = -1;
+    int minDistance = colorTolerance * colorTolerance;
+    for (int i = 0; i < paletteColors.size(); ++i) {
+        const int dr = qRed(rgb) - qRed(paletteColors[i]);
+        const int dg = qGreen(rgb) - qGreen(paletteColors[i]);
+        const int db = qBlue(rgb) - qBlue(paletteColors[i]);
+        const int distance = dr * dr + dg * dg + db * db;
+        if (distance <= minDistance) {
+            minDistance = distance;
+            nearest = paletteIndexes[i];
+        }
+    }
+    return nearest;
+}
+
+/**
+ * Defines the color @p rgba and returns its index in colorNames.
+ * Since xcolor has no notion of alpha, translucent colors are mapped
+ * to the opaque color.
+ */
+int QTikzPicturePrivate::addColor(QRgb rgba)
+{
+    QString name;
+    if (qAlpha(rgba) == 255) {
+        // map the color to the palette, if enabled
+        int index = -1;
+        if (colorLevels > 1) {
+            const int step = colorLevels - 1;
+            const QRgb snapped = qRgb((qRed(rgba) * step + 127) / 255 * 255 / step,
+                                      (qGreen(rgba) * step + 127) / 255 * 255 / step,
+                                      (qBlue(rgba) * step + 127) / 255 * 255 / step);
+            if (snapped != rgba) {
+                index = colorTable.value(snapped);
+                if (index < 0) {
+                    index = addColor(snapped);
+                }
+            }
+        }
+        if (index < 0 && colorTolerance > 0) {
+            index = nearestColor(rgba);
+        }
+        if (index >= 0) {
+            // cache the mapping, so that the next lookup is a single probe
+            colorTable.insert(rgba, index);
+            return index;
+        }
+
+        char buffer[8];
+        const int len = formatColorName(buffer, rgba);
+        name = QLatin1String(buffer, len);
+        if (statsEnabled) {
+            ++stats.colors;
+        }
+
+        defineColor(buffer, len, rgba);
+
+        paletteColors.append(rgba);
+        paletteIndexes.append(colorNames.size());
+    } else {
+        const QRgb opaque = rgba | 0xff000000u;
+        int index = colorTable.value(opaque);
+        if (index < 0) {
+            index = addColor(opaque);
+        }
+        colorTable.insert(rgba, index);
+        return index;
+    }
+
+    colorNames.append(name);
+    colorTable.insert(rgba, colorNames.size() - 1);
+    return colorNames.size() - 1;
+}
+
+/**
+ * Returns the name of the color @p rgba, defining it on first use.
+ */
+QString QTikzPicturePrivate::colorName(QRgb rgba)
+{
+    int index = colorTable.value(rgba);
+    if (index < 0) {
+        index = addColor(rgba);
+    }
+
+    return colorNames[index];
+}
+
+/**
+ * Returns the style to use instead of @p opts, or @p opts itself.
+ * Each call counts as usage, so frequently used options are promoted
+ * to a style once they reach the style threshold.
+ */
+const QString & QTikzPicturePrivate::options(const QString & opts)
+{
+    if (styleThreshold <= 0 && optionTable.isEmpty()) return opts;
+
+    QTikzOptionEntry & entry = optionTable[opts];
+    if (entry.depth < 0) {
+        // '#' would be interpreted as style parameter
+        if (styleThreshold <= 0 || ++entry.count < styleThreshold || opts.contains('#')) {
+            return opts;
+        }
+        defineStyle(opts, entry);
+    }
+    return entry.style;
+}
+
+/**
+ * Returns the name of a new style. In asynchronous mode, both the calling
+ * thread and the worker name styles, so they count on a shared counter.
+ */
+QString QTikzPicturePrivate::newStyleName()
+{
+    const int number = sharedStyleCount ? sharedStyleCount->fetchAndAddRelaxed(1) + 1 : ++styleCount;
+    return stylePrefix + QString::number(number);
+}
+
+void QTikzPicturePrivate::defineStyle(const QString & opts, QTikzOptionEntry & entry)
+{
+    if (entry.style.isEmpty()) {
+        entry.style = newStyleName();
+    }
+
+    write("\\tikzset{");
+    write(entry.style);
+    write("/.style={");
+    write(opts);
+    write("}}\n");
+
+    entry.depth = scopeDepth;
+    styleStack.append(opts);
+}
+
+/**
+ * Define the @p style recorded by registerStyle() in retained mode on
+ * replay, unless it is still defined at the depth of the replayed scopes.
+ */
+void QTikzPicturePrivate::defineRecordedStyle(const QString & opts, const QString & style)
+{
+    QTikzOptionEntry & entry = optionTable[opts];
+    if (entry.depth >= 0) {
+        if (entry.style == style) return;
+        styleStack.removeAll(opts);
+    }
+    entry.style = style;
+    defineStyle(opts, entry);
+}
+
+void QTikzPicturePrivate::openScope(bool hasOptions)
+{
+    if (displayList) {
+        record(QTikzDisplayCommand::OpenScope, PathCommands[0], QString()).count = hasOptions ? 1 : 0;
+        return;
+    }
+
+    ++scopeDepth;
+    clipStack.append(clipBounds);
+
+    // the options may shift, scale or rotate the coordinate system, so the
+    // clip rectangle of the enclosing scopes does not apply to its contents
+    if (hasOptions) {
+        clipBounds = QTikzBounds();
+    }
+}
+
+void QTikzPicturePrivate::closeScope()
+{
+    if (displayList) {
+        record(QTikzDisplayCommand::CloseScope, PathCommands[0], QString());
+        return;
+    }
+
+    // \tikzset is local to the TeX group, so styles defined in the
+    // closed scope have to be defined again on their next use
+    while (!styleStack.isEmpty()) {
+        QTikzOptionEntry & entry = optionTable[styleStack.last()];
+        if (entry.depth < scopeDepth) break;
+        entry.depth = -1;
+        styleStack.removeLast();
+    }
+    while (!symbolStack.isEmpty()) {
+        QTikzSymbol & symbol = symbols[symbolStack.last()];
+        if (symbol.depth < scopeDepth) break;
+        symbol.depth = -1;
+        symbolStack.removeLast();
+    }
+
+    scopeDepth = qMax(0, scopeDepth - 1);
+
+    // \clip is local to the scope as well
+    if (!clipStack.isEmpty()) {
+        clipBounds = clipStack.last();
+        clipStack.removeLast();
+    }
+}
+
+/**
+ * Define or replace the symbol @p name, which is defined in the output
+ * on its next use.
+ */
+void QTikzPicturePrivate::setSymbol(const QString & name, const QTikzSymbol & symbol)
+{
+    symbolStack.removeAll(name);
+    QTikzSymbol & entry = symbols[name];
+    entry = symbol;
+    entry.depth = -1;
+}
+
+/**
+ * Take over the symbols of @p other that were defined or replaced since.
+ */
+void QTikzPicturePrivate::updateSymbols(const QHash<QString, QTikzSymbol> & other)
+{
+    for (auto it = other.constBegin(); it != other.constEnd(); ++it) {
+        auto current = symbols.constFind(it.key());
+        if (current == symbols.constEnd() || current.value().revision != it.value().revision) {
+            setSymbol(it.key(), it.value());
+        }
+    }
+}
+
+/**
+ * Write the pic definition of the symbol @p name. Its path is converted
+ * again only if a setting affecting the output has changed since.
+ */
+void QTikzPicturePrivate::defineSymbol(const QString & name, QTikzSymbol & symbol)
+{
+    const quint64 settings = settingsFingerprint(writer);
+    if (symbol.definition.isEmpty() || symbol.settings != settings) {
+        symbol.definition.clear();
+        QTikzPathWriter symbolWriter(symbol.definition, 0);
+        symbolWriter.copySettings(writer);
+        symbolWriter.write("\\tikzset{");
+        symbolWriter.write(name);
+        symbolWriter.write("/.pic={\\path");
+        if (!symbol.options.isEmpty()) {
+            symbolWriter.write("[");
+            symbolWriter.write(symbol.options);
+            symbolWriter.write("]");
+        }
+        symbolWriter.write(" ");
+        symbolWriter.writeTikzPath(symbol.path);
+        symbolWriter.write(";}}\n");
+        symbol.settings = settings;
+    }
+
+    write(symbol.definition.constData(), symbol.definition.size());
+    symbol.depth = scopeDepth;
+    symbolStack.append(name);
+}
+
+void QTikzPicturePrivate::placeSymbols(const QString & name, const QPointF * positions, int count)
+{
+    if (!hasSink() || count <= 0 || !symbols.contains(name)) return;
+
+    QTikzStatsTimer timer(this);
+    if (statsEnabled) {
+        stats.symbols += count;
+    }
+
+    QTikzSymbol & symbol = symbols[name];
+    if (rasterList) {
+        // rendered into the image like any other path
+        QPainterPath instances;
+        for (int i = 0; i < count; ++i) {
+            instances.addPath(symbol.path.translated(positions[i]));
+        }
+        QTikzDisplayCommand & command = record(QTikzDisplayCommand::PainterPath, PathCommands[0], symbol.options);
+        command.count = displayList->appendShape(instances);
+        return;
+    }
+
+    if (displayList) {
+        QTikzDisplayCommand & command = record(QTikzDisplayCommand::Symbol, PathCommands[0], name);
+        command.count = displayList->appendPoints(positions, count);
+        return;
+    }
+
+    // all instances are placed by a single path command
+    bool started = false;
+    for (int i = 0; i < count; ++i) {
+        if (culling) {
+            const QTikzBounds & b = symbol.bounds;
+            const QPointF & pos = positions[i];
+            if (!isVisible("\\path", QTikzBounds(b.left + pos.x(), b.top + pos.y(),
+                                                  b.right + pos.x(), b.bottom + pos.y()))) {
+                continue;
+            }
+        }
+
+        if (started) {
+            writer.writeSubpathSeparator();
+        } else {
+            if (symbol.depth < 0) {
+                defineSymbol(name, symbol);
+            }
+            write("\\path ");
+            started = true;
+        }
+        writer.writeCoord(positions[i]);
+        write(" pic {");
+        write(name);
+        write("}");
+    }
+
+    if (started) {
+        write(";\n");
+        sync();
+    }
+}
+
+/**
+ * Returns the counter of QTikzStats for the path command @p cmd.
+ */
+/**
+ * Add the counters of @p other, but not its output, to the statistics.
+ */
+void QTikzPicturePrivate::addCounts(const QTikzStats & other)
+{
+    // the output is counted by flush() of this picture
+    QTikzStats counts = other;
+    counts.bytes = 0;
+    counts.writeTime = 0;
+    stats += counts;
+}
+
+/**
+ * Add the output counters of @p output to the statistics, and reset them.
+ */
+void QTikzPicturePrivate::addOutputCounts(QTikzStats & output)
+{
+    QTikzStats written;
+    written.bytes = output.bytes;
+    written.formatTime = output.formatTime;
+    written.writeTime = output.writeTime;
+    stats += written;
+    output = QTikzStats();
+}
+
+QTikzStats QTikzPicturePrivate::currentStats() const
+{
+    QTikzStats current = stats;
+    if (statsEnabled && !displayList) {
+        current.bytes += buffer.size();
+    }
+    return current;
+}
+
+void QTikzPicturePrivate::trace(QTikzPicture::TraceEvent event, int depth)
+{
+    if (traceFunction) {
+        traceFunction(event, depth, currentStats());
+    }
+}
+
+/**
+ * Returns whether a shape with @p shapeBounds may be visible within the
+ * current clip rectangle. For \clip, the clip rectangle is narrowed to
+ * @p shapeBounds instead.
+ */
+bool QTikzPicturePrivate::isVisible(const char * cmd, const QTikzBounds & shapeBounds)
+{
+    if (strcmp(cmd, "\\clip") == 0) {
+        clipBounds.intersect(shapeBounds);
+        return true;
+    }
+
+    return !shapeBounds.isOutside(clipBounds.adjusted(cullingMargin));
+}
+
+/**
+ * Returns @p polygon clipped to the current clip rectangle, if geometric
+ * clipping is enabled. Polygons used for \clip are never changed.
+ */
+const QPolygonF & QTikzPicturePrivate::clipped(const char * cmd, const QPolygonF & polygon)
+{
+    if (!culling || !clipGeometry || strcmp(cmd, "\\clip") == 0) return polygon;
+
+    const QTikzBounds visible = clipBounds.adjusted(cullingMargin);
+    if (bounds(polygon).isInside(visible)) return polygon;
+
+    clipPolygon(polygon.constData(), polygon.size(), visible, clipPolygonBuffer, clipScratchBuffer);
+    if (clipPolygonBuffer.size() < 3) {
+        clipPolygonBuffer.resize(0);
+    }
+    return clipPolygonBuffer;
+}
+
+void QTikzPicturePrivate::writeCommand(const char * cmd, const QString & opts)
+{
+    // may write a style definition, so look up before writing cmd
+    const QString & style = opts.isEmpty() ? opts : options(opts);
+
+    write(cmd);
+    if (! style.isEmpty()) {
+        write("[");
+        write(style);
+        write("]");
+    }
+    write(" ");
+}
+
+/**
+ * Write @p cmd with the prepared prefix of @p style, unless its options
+ * may have to be replaced by a style.
+ */
+void QTikzPicturePrivate::writeCommand(const char * cmd, const QTikzStyle & style)
+{
+    const int index = pathCommandIndex(cmd);
+    if (index < 0 || styleThreshold > 0 || !optionTable.isEmpty()) {
+        writeCommand(cmd, style.options());
+        return;
+    }
+
+    const QByteArray & prefix = style.prefixes[index];
+    write(prefix.constData(), prefix.size());
+}
+
+template <typename Options, typename Shape>
+void QTikzPicturePrivate::writePath(const char * cmd, const Options & options, const Shape & shape)
+{
+    if (! hasSink()) return;
+    if (isEmpty(shape)) return;
+
+    QTikzStatsTimer timer(this);
+    if (statsEnabled) {
+        count(cmd, shape);
+    }
+
+    if (displayList) {
+        QTikzDisplayCommand & command = record(QTikzDisplayList::shapeType(shape), cmd, optionString(options));
+        command.count = displayList->appendShape(shape);
+        return;
+    }
+
+    if ((culling || pathCommandIndex(cmd) == 3) && !isVisible(cmd, bounds(shape))) return;
+
+    const Shape & visibleShape = clipped(cmd, shape);
+    if (isEmpty(visibleShape)) return;
+
+    writeCommand(cmd, options);
+    writeShape(visibleShape);
+    write(";\n");
+    sync();
+}
+
+template <typename Options, typename ShapeAt>
+void QTikzPicturePrivate::writePaths(const char * cmd, const Options & options, int count, ShapeAt shapeAt)
+{
+    if (! hasSink()) return;
+
+    QTikzStatsTimer timer(this);
+    if (displayList) {
+        int index = -1;
+        for (int i = 0; i < count; ++i) {
+            const auto shape = shapeAt(i);
+            if (isEmpty(shape)) continue;
+            if (statsEnabled) this->count(cmd, shape);
+
+            if (index < 0) {
+                record(QTikzDisplayList::shapeType(shape), cmd, optionString(options));
+                index = displayList->commands.size() - 1;
+            }
+            displayList->commands[index].count += displayList->appendShape(shape);
+        }
+        return;
+    }
+
+    // emit all shapes as subpaths of a single path command
+    bool started = false;
+    for (int i = 0; i < count; ++i) {
+        const auto shape = shapeAt(i);
+        if (isEmpty(shape)) continue;
+        if (statsEnabled) this->count(cmd, shape);
+        if ((culling || pathCommandIndex(cmd) == 3) && !isVisible(cmd, bounds(shape))) continue;
+
+        if (started) {
+            writer.writeSubpathSeparator();
+        } else {
+            writeCommand(cmd, options);
+            started = true;
+        }
+        writeShape(shape);
+    }
+
+    if (started) {
+        write(";\n");
+        sync();
+    }
+}
+
+void QTikzPicturePrivate::writeLine(const QPointF * points, int size, const QString & options)
+{
+    if (!hasSink() || size < 2) return;
+
+    QTikzStatsTimer timer(this);
+    if (maxPathPoints > 0 && size > maxPathPoints && !displayList) {
+        // split into several path commands
+        beginStream(LineStream, options);
+        addStreamPoints(points, size);
+        endStream();
+        return;
+    }
+
+    if (statsEnabled) {
+        ++stats.lines;
+        stats.points += size;
+    }
+
+    if (displayList) {
+        // simplified on replay, so that the tolerance may still change
+        QTikzDisplayCommand & command = record(QTikzDisplayCommand::Polyline, PathCommands[1], options);
+        command.count = displayList->appendPoints(points, size);
+        return;
+    }
+
+    if (culling) {
+        const QTikzBounds lineBounds(points, size);
+        if (!isVisible("\\draw", lineBounds)) return;
+
+        const QTikzBounds visible = clipBounds.adjusted(cullingMargin);
+        if (clipGeometry && !lineBounds.isInside(visible)) {
+            clipBuffer.resize(0);
+            pieceBuffer.resize(0);
+            clipPolyline(points, size, visible, clipBuffer, pieceBuffer, outcodeBuffer);
+            if (pieceBuffer.isEmpty()) return;
+
+            // the visible pieces are subpaths of a single path
+            writeCommand("\\draw", options);
+            int begin = 0;
+            for (int i = 0; i < pieceBuffer.size(); ++i) {
+                if (i > 0) {
+                    write(" ");
+                }
+                writer.writePolyline(clipBuffer.constData() + begin, pieceBuffer[i] - begin);
+                begin = pieceBuffer[i];
+            }
+            write(";\n");
+            sync();
+            return;
+        }
+    }
+
+    writeCommand("\\draw", options);
+    writer.writePolyline(points, size);
+    write(";\n");
+    sync();
+}
+
+/**
+ * Start a streamed polyline or path with @p options.
+ */
+void QTikzPicturePrivate::beginStream(StreamKind kind, const QString & options)
+{
+    endStream();
+
+    streamKind = kind;
+    streamOptions = options;
+    streamStarted = false;
+    hasStreamPoint = false;
+    streamPointWritten = false;
+    streamPoints = 0;
+
+    if (statsEnabled && hasSink()) {
+        ++(kind == LineStream ? stats.lines : stats.paths);
+    }
+}
+
 /**
- * Private data class for QTikzPicture.
+ * Add the @p count points @p points to the streamed polyline. The chunk is
+ * culled, clipped and simplified as a polyline continuing at the last
+ * point of the previous chunk, and written right away.
  */
-class QTikzPicturePrivate
+void QTikzPicturePrivate::addStreamPoints(const QPointF * points, int count)
 {
-public:
-    QTextStream* ts;
-    QHash<QString, bool> colors;
-    int precision;
+    if (streamKind != LineStream || count <= 0 || !hasSink()) return;
 
-public:
-    inline QString toCoord(const QPointF & pt) const;
-    QString toTikzPath(const QPainterPath & path) const;
-    QString toTikzPath(const QPolygonF & polygon) const;
-    QString toTikzPath(const QRectF & rect) const;
-    QString toTikzPath(const QLineF & line) const;
-    QString toTikzPath(const QPointF & circleCenter, qreal radius) const;
-
-    void writePath(const QString & cmd, const QString & options, const QString & path);
-};
+    QTikzStatsTimer timer(this);
+    if (statsEnabled) {
+        stats.points += count;
+    }
+
+    if (displayList) {
+        for (int i = 0; i < count; ++i) {
+            streamValues << points[i].x() << points[i].y();
+        }
+        return;
+    }
+
+    // prepend the last point of the previous chunk
+    const QPointF * sequence = points;
+    int size = count;
+    if (hasStreamPoint) {
+        streamBuffer.resize(0);
+        streamBuffer.append(streamPoint);
+        for (int i = 0; i < count; ++i) {
+            streamBuffer.append(points[i]);
+        }
+        sequence = streamBuffer.constData();
+        size = streamBuffer.size();
+    }
+
+    const bool continues = streamPointWritten;
+    streamPoint = sequence[size - 1];
+    hasStreamPoint = true;
+    streamPointWritten = false;
+    if (size < 2) return;
+
+    if (culling) {
+        const QTikzBounds chunkBounds(sequence, size);
+        if (!isVisible("\\draw", chunkBounds)) return;
+
+        const QTikzBounds visible = clipBounds.adjusted(cullingMargin);
+        if (clipGeometry && !chunkBounds.isInside(visible)) {
+            clipBuffer.resize(0);
+            pieceBuffer.resize(0);
+            clipPolyline(sequence, size, visible, clipBuffer, pieceBuffer, outcodeBuffer);
+
+            int begin = 0;
+            for (int i = 0; i < pieceBuffer.size(); ++i) {
+                // a piece starting at the first point continues the current subpath
+                const bool continuesPiece = continues && begin == 0
+                    && clipBuffer[0].x() == sequence[0].x() && clipBuffer[0].y() == sequence[0].y();
+                writeStreamPolyline(clipBuffer.constData() + begin, pieceBuffer[i] - begin, continuesPiece);
+                begin = pieceBuffer[i];
+            }
+
+            streamPointWritten = !clipBuffer.isEmpty()
+                && clipBuffer.last().x() == streamPoint.x() && clipBuffer.last().y() == streamPoint.y();
+            sync();
+            return;
+        }
+    }
+
+    writeStreamPolyline(sequence, size, continues);
+    streamPointWritten = true;
+    sync();
+}
 
-QString QTikzPicturePrivate::toCoord(const QPointF & pt) const
+/**
+ * Write one visible piece of the streamed polyline. If @p continues is
+ * true, the first point is the current point of the output already.
+ */
+void QTikzPicturePrivate::writeStreamPolyline(const QPointF * points, int count, bool continues)
 {
-    QLocale l = QLocale::c();
+    const QPointF * simplifiedPoints = writer.simplified(points, count);
+
+    if (!continues) {
+        if (!streamStarted) {
+            writeCommand("\\draw", streamOptions);
+            streamStarted = true;
+        } else {
+            writer.flushLineTo();
+            write(" ");
+        }
+        writer.writeStartPoint(simplifiedPoints[0]);
+        streamPoints = 1;
+    }
 
-    return "(" + l.toString(pt.x(), 'g', precision) + ", "
-               + l.toString(pt.y(), 'g', precision) + ")";
+    for (int i = 1; i < count; ++i) {
+        if (maxPathPoints > 0 && streamPoints >= maxPathPoints) {
+            // continue in a new path command, starting at the previous point
+            writer.flushLineTo();
+            write(";\n");
+            writeCommand("\\draw", streamOptions);
+            writer.writeStartPoint(simplifiedPoints[i - 1]);
+            streamPoints = 1;
+        }
+        writer.writeLineTo(simplifiedPoints[i]);
+        ++streamPoints;
+    }
 }
 
-QString QTikzPicturePrivate::toTikzPath(const QPainterPath & path) const
+/**
+ * Add an element to the streamed path, like the QPainterPath functions.
+ * Curves are passed as CurveToElement followed by two CurveToDataElements.
+ */
+void QTikzPicturePrivate::addStreamElement(QPainterPath::ElementType type, const QPointF & pt)
 {
-    if (path.isEmpty()) return QString();
+    if (streamKind != PathStream || !hasSink()) return;
 
-    QStringList pathList;
-    QString currentPath;
-    int currentControlPoint = 0;
+    QTikzStatsTimer timer(this);
+    if (statsEnabled) {
+        ++stats.elements;
+    }
 
-    // convert QPainterPath to a TikZ path string
-    for (int i = 0; i < path.elementCount(); i++) {
-        const QPainterPath::Element & element = path.elementAt(i);
+    // like QPainterPath, start at the origin if there is no current point
+    if (type != QPainterPath::MoveToElement && !hasStreamPoint) {
+        addStreamElement(QPainterPath::MoveToElement, QPointF(0, 0));
+    }
 
-        switch (element.type) {
-            case QPainterPath::MoveToElement: {
-                // close current path + append to path list
-                if (!currentPath.isEmpty()) {
-                    currentPath += " -- cycle";
-                    pathList << currentPath;
-                }
+    if (displayList) {
+        streamValues << double(type) << pt.x() << pt.y();
+    } else {
+        switch (type) {
+        case QPainterPath::MoveToElement:
+            writer.flushLineTo();
+            if (!streamStarted) {
+                writeCommand("\\path", streamOptions);
+                streamStarted = true;
+            } else {
+                writer.writeSubpathSeparator();
+            }
+            writer.writeStartPoint(pt);
+            break;
+        case QPainterPath::LineToElement:
+            writer.writeLineTo(pt);
+            break;
+        case QPainterPath::CurveToElement:
+            writer.flushLineTo();
+            write(" .. controls ");
+            writer.writeCoord(pt);
+            break;
+        case QPainterPath::CurveToDataElement:
+            if (streamPoints == 0) {
+                write(" and ");
+                writer.writeCoord(pt);
+            } else {
+                write(" .. ");
+                writer.writeStartPoint(pt);
+            }
+            break;
+        }
+    }
 
-                // indent with spaces for better readability
-                const char * indentString = pathList.count() ? "    " : "";
+    // streamPoints counts the control points of a curve
+    if (type == QPainterPath::CurveToElement) {
+        streamPoints = 0;
+    } else if (type == QPainterPath::CurveToDataElement) {
+        ++streamPoints;
+    }
 
-                // start new path
-                currentPath.clear();
-                currentPath += indentString + toCoord(element);
-                break;
+    if (type == QPainterPath::MoveToElement) {
+        streamSubpathStart = pt;
+    }
+    if (type != QPainterPath::CurveToElement && (type != QPainterPath::CurveToDataElement || streamPoints == 2)) {
+        streamPoint = pt;
+    }
+    hasStreamPoint = true;
+    sync();
+}
+
+void QTikzPicturePrivate::endStream()
+{
+    if (streamKind == NoStream) return;
+
+    const StreamKind kind = streamKind;
+    streamKind = NoStream;
+
+    if (displayList) {
+        const int values = kind == LineStream ? 2 : 3;
+        if (!streamValues.isEmpty()) {
+            QTikzDisplayCommand & command = record(kind == LineStream ? QTikzDisplayCommand::Polyline
+                                                                      : QTikzDisplayCommand::PainterPath,
+                                                   kind == LineStream ? PathCommands[1] : PathCommands[0],
+                                                   streamOptions);
+            displayList->values += streamValues;
+            command.count = streamValues.size() / values;
+        }
+        streamValues.clear();
+        return;
+    }
+
+    if (streamStarted) {
+        writer.flushLineTo();
+        write(";\n");
+        sync();
+    }
+}
+
+/**
+ * Adds a command to the display list, after all pending text.
+ */
+QTikzDisplayCommand & QTikzPicturePrivate::record(QTikzDisplayCommand::Type type, const char * cmd, const QString & options)
+{
+    flush();
+    if (async && !rasterList
+        && displayList->values.size() + displayList->commands.size() >= AsyncChunkSize) {
+        submitAsync(false);
+    }
+    return displayList->addCommand(type, cmd, options);
+}
+
+/**
+ * Take over the output settings of @p source, but not its sink and precision.
+ */
+void QTikzPicturePrivate::copySettings(const QTikzPicturePrivate & source)
+{
+    const int targetPrecision = writer.precision;
+    writer.copySettings(source.writer);
+    writer.precision = targetPrecision;
+    threadCount = source.threadCount;
+    pathCache = source.pathCache;
+    culling = source.culling;
+    cullingMargin = source.cullingMargin;
+    clipGeometry = source.clipGeometry;
+    bufferSize = source.bufferSize;
+    styleThreshold = source.styleThreshold;
+    styleCount = source.styleCount;
+    stylePrefix = source.stylePrefix;
+    statsEnabled = source.statsEnabled;
+    symbols = source.symbols;
+    for (auto it = symbols.begin(); it != symbols.end(); ++it) {
+        it.value().depth = -1;
+    }
+}
+
+QTikzPictureState QTikzPicturePrivate::state() const
+{
+    QTikzPictureState current;
+    current.outputOffset = outputOffset;
+    current.colorNames = colorNames;
+    current.colorTable = colorTable;
+    current.paletteColors = paletteColors;
+    current.paletteIndexes = paletteIndexes;
+    current.optionTable = optionTable;
+    current.styleStack = styleStack;
+    current.styleCount = styleCount;
+    current.scopeDepth = scopeDepth;
+    current.traceDepth = traceDepth;
+    current.rasterCount = rasterCount;
+    current.clipBounds = clipBounds;
+    current.clipStack = clipStack;
+    current.symbols = symbols;
+    current.symbolStack = symbolStack;
+    return current;
+}
+
+/**
+ * Continue with the @p state from state(), except for the output offset.
+ */
+void QTikzPicturePrivate::setState(const QTikzPictureState & state)
+{
+    colorNames = state.colorNames;
+    colorTable = state.colorTable;
+    paletteColors = state.paletteColors;
+    paletteIndexes = state.paletteIndexes;
+    optionTable = state.optionTable;
+    styleStack = state.styleStack;
+    styleCount = state.styleCount;
+    scopeDepth = state.scopeDepth;
+    traceDepth = state.traceDepth;
+    rasterCount = state.rasterCount;
+    clipBounds = state.clipBounds;
+    clipStack = state.clipStack;
+
+    // the definitions of the symbols are generated again when needed
+    symbols = state.symbols;
+    for (auto it = symbols.begin(); it != symbols.end(); ++it) {
+        it.value().definition.clear();
+        it.value().revision = ++symbolRevision;
+    }
+    symbolStack = state.symbolStack;
+}
+
+/**
+ * Writes all commands of @p list as if they were called on this picture.
+ */
+void QTikzPicturePrivate::replay(const QTikzDisplayList & list)
+{
+    for (int i = 0; i < list.commands.size(); ++i) {
+        const QTikzDisplayCommand & command = list.commands[i];
+        const bool hasOptions = command.string >= 0 && command.type != QTikzDisplayCommand::Text;
+        const QString options = hasOptions ? list.strings[command.string] : QString();
+        const double * v = list.values.constData() + command.first;
+        const char * cmd = PathCommands[command.path];
+
+        switch (command.type) {
+        case QTikzDisplayCommand::Text: {
+            const QByteArray & text = list.texts[command.string];
+            write(text.constData(), text.size());
+            break;
+        }
+        case QTikzDisplayCommand::Color: {
+            const QByteArray name = options.toLatin1();
+            writeColorDefinition(name.constData(), name.size(), QRgb(command.first));
+            break;
+        }
+        case QTikzDisplayCommand::Style:
+            defineRecordedStyle(options, list.strings[command.first]);
+            break;
+        case QTikzDisplayCommand::OpenScope:
+            openScope(command.count != 0);
+            break;
+        case QTikzDisplayCommand::CloseScope:
+            closeScope();
+            break;
+        case QTikzDisplayCommand::Rect:
+            writePaths(cmd, options, command.count,
+                       [v](int j) { return QRectF(v[4 * j], v[4 * j + 1], v[4 * j + 2], v[4 * j + 3]); });
+            break;
+        case QTikzDisplayCommand::Line:
+            writePaths(cmd, options, command.count,
+                       [v](int j) { return QLineF(v[4 * j], v[4 * j + 1], v[4 * j + 2], v[4 * j + 3]); });
+            break;
+        case QTikzDisplayCommand::Circle:
+            writePaths(cmd, options, command.count,
+                       [v](int j) { return QTikzCircle(QPointF(v[3 * j], v[3 * j + 1]), v[3 * j + 2]); });
+            break;
+        case QTikzDisplayCommand::Polygon:
+        case QTikzDisplayCommand::Polyline: {
+            QPolygonF points(command.count);
+            for (int j = 0; j < command.count; ++j) {
+                points[j] = QPointF(v[2 * j], v[2 * j + 1]);
             }
-            case QPainterPath::LineToElement: {
-                currentPath += " -- " + toCoord(element);
-                break;
+            if (command.type == QTikzDisplayCommand::Polygon) {
+                writePath(cmd, options, points);
+            } else {
+                writeLine(points.constData(), points.size(), options);
             }
-            case QPainterPath::CurveToElement: {
-                currentPath += " .. controls " + toCoord(element);
-                currentControlPoint = 1;
+            break;
+        }
+        case QTikzDisplayCommand::PainterPath:
+            writePath(cmd, options, toPainterPath(command, v));
+            break;
+        case QTikzDisplayCommand::Symbol: {
+            QVector<QPointF> positions(command.count);
+            for (int j = 0; j < command.count; ++j) {
+                positions[j] = QPointF(v[2 * j], v[2 * j + 1]);
+            }
+            placeSymbols(options, positions.constData(), positions.size());
+            break;
+        }
+        }
+    }
+    sync();
+}
+
+/**
+ * Returns the file name of the images of raster scopes without suffix.
+ * By default, the images are written next to the output file.
+ */
+QString QTikzPicturePrivate::imageBaseName() const
+{
+    if (!rasterBaseName.isEmpty()) return rasterBaseName;
+
+    QFile * file = qobject_cast<QFile *>(ts ? ts->device() : device);
+    if (file && !file->fileName().isEmpty()) {
+        const QString name = file->fileName();
+        const int dot = name.lastIndexOf(QLatin1Char('.'));
+        return dot > name.lastIndexOf(QLatin1Char('/')) ? name.left(dot) : name;
+    }
+    return QLatin1String("qtikzpicture");
+}
+
+/**
+ * Collect the color and style names the options of a raster scope may use.
+ */
+void QTikzPicturePrivate::rasterNames(QTikzRasterNames & names)
+{
+    // further colors of the xcolor package, which TikZ loads
+    static const struct { const char * name; QRgb rgb; } xcolorNames[] = {
+        { "gray", 0xff808080u }, { "darkgray", 0xff404040u }, { "lightgray", 0xffbfbfbfu },
+        { "brown", 0xffbf8040u }, { "lime", 0xffbfff00u }, { "olive", 0xff808000u },
+        { "orange", 0xffff8000u }, { "pink", 0xffffbfbfu }, { "purple", 0xffbf0040u },
+        { "teal", 0xff008080u }, { "violet", 0xff800080u }
+    };
+    for (size_t i = 0; i < sizeof(xcolorNames) / sizeof(xcolorNames[0]); ++i) {
+        names.colors.insert(QLatin1String(xcolorNames[i].name), xcolorNames[i].rgb);
+    }
+
+    // layers of a QTikzRecorder define their colors in the recorded picture
+    QTikzPicturePrivate * colors = shared ? shared : this;
+    QMutexLocker locker(shared ? &shared->mutex : 0);
+    for (int i = 0; i < colors->paletteColors.size(); ++i) {
+        names.colors.insert(colors->colorNames[colors->paletteIndexes[i]], colors->paletteColors[i]);
+    }
+    locker.unlock();
+
+    for (auto it = optionTable.constBegin(); it != optionTable.constEnd(); ++it) {
+        if (!it.value().style.isEmpty()) {
+            names.styles.insert(it.value().style, it.key());
+        }
+    }
+}
+
+/**
+ * Render the geometry of the raster scope @p list into an image, and
+ * reference the image with a node. Everything else, i.e. text, color
+ * definitions and scopes, is written as usual.
+ */
+void QTikzPicturePrivate::writeRaster(const QTikzDisplayList & list)
+{
+    QTikzRasterNames names;
+    rasterNames(names);
+
+    // the style of each combination of path command and options
+    QHash<int, QTikzRasterStyle> styles;
+    auto styleOf = [&](const QTikzDisplayCommand & command) -> const QTikzRasterStyle & {
+        const int key = (command.string + 1) * 4 + command.path;
+        if (!styles.contains(key)) {
+            QTikzRasterStyle style(command.path);
+            if (command.string >= 0) {
+                rasterStyle(list.strings[command.string], names, style, 8);
+            }
+            styles.insert(key, style);
+        }
+        return styles[key];
+    };
+
+    // first pass: write everything but the geometry, and compute the
+    // bounds of its visible part
+    QTikzBounds extent;
+    extent.left = extent.top = std::numeric_limits<qreal>::infinity();
+    extent.right = extent.bottom = -std::numeric_limits<qreal>::infinity();
+    QTikzBounds clip;
+    QVector<QTikzBounds> clips;
+    for (int i = 0; i < list.commands.size(); ++i) {
+        const QTikzDisplayCommand & command = list.commands[i];
+        switch (command.type) {
+        case QTikzDisplayCommand::Text: {
+            const QByteArray & text = list.texts[command.string];
+            write(text.constData(), text.size());
+            break;
+        }
+        case QTikzDisplayCommand::Color: {
+            const QByteArray name = list.strings[command.string].toLatin1();
+            defineColor(name.constData(), name.size(), QRgb(command.first));
+            break;
+        }
+        case QTikzDisplayCommand::Style:
+            defineRecordedStyle(list.strings[command.string], list.strings[command.first]);
+            break;
+        case QTikzDisplayCommand::OpenScope:
+            openScope(command.count != 0);
+            clips.append(clip);
+            break;
+        case QTikzDisplayCommand::CloseScope:
+            closeScope();
+            if (!clips.isEmpty()) {
+                clip = clips.last();
+                clips.removeLast();
+            }
+            break;
+        default: {
+            const QTikzRasterStyle & style = styleOf(command);
+            if (command.path != 3 && !style.draw && !style.fill) break;
+
+            QTikzBounds shape = bounds(toPainterPath(command, list.values.constData() + command.first));
+            if (command.path == 3) {
+                clip.intersect(shape);
                 break;
             }
-            case QPainterPath::CurveToDataElement: {
-                if (currentControlPoint == 1) {
-                    currentPath += " and " + toCoord(element);
-                    ++currentControlPoint;
-                } else if (currentControlPoint == 2) {
-                    currentPath += " .. " + toCoord(element);
-                    currentControlPoint = 0;
+
+            shape = shape.adjusted(style.draw ? style.lineWidth * CentimetersPerPoint : 0);
+            shape.intersect(clip);
+            if (shape.left <= shape.right && shape.top <= shape.bottom) {
+                extent.left = qMin(extent.left, shape.left);
+                extent.top = qMin(extent.top, shape.top);
+                extent.right = qMax(extent.right, shape.right);
+                extent.bottom = qMax(extent.bottom, shape.bottom);
+            }
+            break;
+        }
+        }
+    }
+    if (!(extent.left <= extent.right && extent.top <= extent.bottom)) return;
+
+    // pixels per centimeter, limited by the maximum image size
+    qreal scale = rasterDpi / 2.54;
+    const qreal maxExtent = qMax(extent.right - extent.left, extent.bottom - extent.top);
+    if (maxExtent * scale > MaxRasterSize) {
+        scale = MaxRasterSize / maxExtent;
+    }
+    const int width = qMax(1, int(std::ceil((extent.right - extent.left) * scale)));
+    const int height = qMax(1, int(std::ceil((extent.bottom - extent.top) * scale)));
+
+    // second pass: render the geometry, the y axis of TikZ points upwards
+    QImage image(width, height, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+    {
+        QPainter painter(&image);
+        painter.setRenderHint(QPainter::Antialiasing);
+        painter.translate(-extent.left * scale, extent.bottom * scale);
+        painter.scale(scale, -scale);
+
+        int depth = 0;
+        for (int i = 0; i < list.commands.size(); ++i) {
+            const QTikzDisplayCommand & command = list.commands[i];
+            switch (command.type) {
+            case QTikzDisplayCommand::Text:
+            case QTikzDisplayCommand::Color:
+            case QTikzDisplayCommand::Style:
+                break;
+            case QTikzDisplayCommand::OpenScope:
+                painter.save();
+                ++depth;
+                break;
+            case QTikzDisplayCommand::CloseScope:
+                if (depth > 0) {
+                    painter.restore();
+                    --depth;
+                }
+                break;
+            default: {
+                QPainterPath path = toPainterPath(command, list.values.constData() + command.first);
+                const QTikzRasterStyle & style = styleOf(command);
+                path.setFillRule(style.evenOdd ? Qt::OddEvenFill : Qt::WindingFill);
+                if (command.path == 3) {
+                    painter.setClipPath(path, Qt::IntersectClip);
+                    break;
+                }
+                if (style.fill) {
+                    QColor color = style.fillColor;
+                    color.setAlphaF(qBound(qreal(0), style.fillOpacity, qreal(1)));
+                    painter.fillPath(path, QBrush(color));
+                }
+                if (style.draw) {
+                    QColor color = style.drawColor;
+                    color.setAlphaF(qBound(qreal(0), style.drawOpacity, qreal(1)));
+                    painter.strokePath(path, QPen(color, style.lineWidth * CentimetersPerPoint,
+                                                  Qt::SolidLine, Qt::FlatCap, Qt::MiterJoin));
                 }
                 break;
             }
+            }
+        }
+    }
+
+    // encode in the background, end() waits for all images
+    const QString fileName = imageBaseName() + QLatin1String("-raster") + QString::number(++rasterCount)
+                           + QLatin1String(".png");
+    if (!imagePool) {
+        imagePool = new QThreadPool;
+        imagePool->setMaxThreadCount(1);
+    }
+    imagePool->start(new QTikzImageWriter(image, fileName));
+
+    // the image covers whole pixels, which may exceed the geometry slightly
+    const qreal imageWidth = width / scale;
+    const qreal imageHeight = height / scale;
+    const int precision = qMax(writer.precision, 6);
+    char buffer[NumberBufferSize];
+    write("\\node[anchor=south west, inner sep=0pt, outer sep=0pt] at (");
+    write(buffer, formatNumber(buffer, extent.left, precision));
+    write(", ");
+    write(buffer, formatNumber(buffer, extent.bottom - imageHeight, precision));
+    write(") {\\includegraphics[width=");
+    write(buffer, formatNumber(buffer, imageWidth, precision));
+    write("cm, height=");
+    write(buffer, formatNumber(buffer, imageHeight, precision));
+    write("cm]{");
+    write(fileName);
+    write("}};\n");
+}
+
+QTikzStats::QTikzStats()
+    : paths(0), draws(0), fills(0), clips(0), circles(0), lines(0)
+    , points(0), elements(0), bytes(0), colors(0), symbols(0), formatTime(0), writeTime(0)
+{
+}
+
+QTikzStats& QTikzStats::operator+=(const QTikzStats& other)
+{
+    paths += other.paths;
+    draws += other.draws;
+    fills += other.fills;
+    clips += other.clips;
+    circles += other.circles;
+    lines += other.lines;
+    points += other.points;
+    elements += other.elements;
+    bytes += other.bytes;
+    colors += other.colors;
+    symbols += other.symbols;
+    formatTime += other.formatTime;
+    writeTime += other.writeTime;
+    return *this;
+}
+
+QTikzStyle::QTikzStyle()
+{
+    for (int i = 0; i < 4; ++i) {
+        prefixes[i] = PathCommands[i];
+        prefixes[i] += ' ';
+    }
+}
+
+QTikzStyle::QTikzStyle(const QString& options)
+    : opts(options)
+{
+    // the same output as QTikzPicturePrivate::writeCommand()
+    const QByteArray utf8 = options.toUtf8();
+    for (int i = 0; i < 4; ++i) {
+        QByteArray & prefix = prefixes[i];
+        prefix = PathCommands[i];
+        if (!utf8.isEmpty()) {
+            prefix += '[';
+            prefix += utf8;
+            prefix += ']';
         }
+        prefix += ' ';
+    }
+}
+
+const QString& QTikzStyle::options() const
+{
+    return opts;
+}
+
+QTikzPicture::QTikzPicture()
+    : d(new QTikzPicturePrivate())
+{
+    d->ts = 0;
+    d->device = 0;
+    d->compressor = 0;
+    d->outputOffset = 0;
+    d->colorLevels = 0;
+    d->colorTolerance = 0;
+    d->styleThreshold = 0;
+    d->styleCount = 0;
+    d->scopeDepth = 0;
+    d->stylePrefix = QLatin1String("s");
+    d->bufferSize = 64 * 1024;
+    d->buffer.reserve(d->bufferSize);
+
+    // some predefined colors
+    d->addPredefinedColor(qRgb(255, 0, 0), "red");
+    d->addPredefinedColor(qRgb(0, 255, 0), "green");
+    d->addPredefinedColor(qRgb(0, 0, 255), "blue");
+    d->addPredefinedColor(qRgb(0, 0, 0), "black");
+    d->addPredefinedColor(qRgb(255, 255, 255), "white");
+    d->addPredefinedColor(qRgb(0, 255, 255), "cyan");
+    d->addPredefinedColor(qRgb(255, 0, 255), "magenta");
+    d->addPredefinedColor(qRgb(255, 255, 0), "yellow");
+}
+
+QTikzPicture::~QTikzPicture()
+{
+    // hand out the buffered output, but never replay a display list
+    if (!d->displayList) {
+        d->flush();
+    }
+    delete d;
+}
+
+void QTikzPicture::setStream(QTextStream* textStream, int precision)
+{
+    if (d->async) return;
+    d->setSink(textStream, 0, WriteFunction(), precision);
+}
+
+void QTikzPicture::setDevice(QIODevice* device, int precision)
+{
+    if (d->async) return;
+    d->setSink(0, device, WriteFunction(), precision);
+}
+
+void QTikzPicture::setCompressedDevice(QIODevice* device, int level, int precision)
+{
+    if (d->async) return;
+
+    QTikzCompressor * compressor = new QTikzCompressor(device, qBound(-1, level, 9));
+
+    // gunzip rejects an empty file, so start with an empty member
+    compressor->writeMember(0, 0);
+    d->setSink(0, 0, [compressor](const char * data, size_t size) { compressor->compress(data, size); },
+               precision);
+    d->compressor = compressor;
+}
+
+void QTikzPicture::setWriteFunction(const WriteFunction& writeFunction, int precision)
+{
+    if (d->async) return;
+    d->setSink(0, 0, writeFunction, precision);
+}
+
+void QTikzPicture::setBufferSize(int size)
+{
+    d->flush();
+    d->bufferSize = qMax(1, size);
+    d->buffer.reserve(d->bufferSize);
+}
+
+int QTikzPicture::bufferSize() const
+{
+    return d->bufferSize;
+}
+
+void QTikzPicture::flush()
+{
+    if (d->rasterList) return;
+
+    if (d->async) {
+        d->waitAsync();
+        return;
+    }
+
+    if (d->displayList) {
+        // replay without recording, then start a new display list
+        d->flush();
+        QTikzDisplayList * list = d->displayList;
+        d->displayList = 0;
+        const QTikzStats recorded = d->stats;
+        d->replay(*list);
+        d->flush();
+        d->displayList = list;
+        list->clear();
+
+        // the shapes were counted when recorded
+        const QTikzStats replayed = d->stats;
+        d->stats = recorded;
+        d->stats.bytes = replayed.bytes;
+        d->stats.formatTime = replayed.formatTime;
+        d->stats.writeTime = replayed.writeTime;
+    }
+
+    d->flush();
+}
+
+void QTikzPicture::setRetainedMode(bool retained)
+{
+    if (d->async || d->rasterList || retained == (d->displayList != 0)) return;
+
+    if (retained) {
+        d->flush();
+        d->displayList = new QTikzDisplayList;
+    } else {
+        flush();
+        delete d->displayList;
+        d->displayList = 0;
+    }
+}
+
+bool QTikzPicture::retainedMode() const
+{
+    if (d->async) return false;
+    return (d->rasterList ? d->rasterOuterList : d->displayList) != 0;
+}
+
+void QTikzPicture::writeTo(QTextStream* textStream, int precision) const
+{
+    writeTo(textStream, 0, WriteFunction(), precision);
+}
+
+void QTikzPicture::writeTo(QIODevice* device, int precision) const
+{
+    writeTo(0, device, WriteFunction(), precision);
+}
+
+void QTikzPicture::writeTo(const WriteFunction& writeFunction, int precision) const
+{
+    writeTo(0, 0, writeFunction, precision);
+}
+
+void QTikzPicture::writeTo(QTextStream* textStream, QIODevice* device,
+                           const WriteFunction& writeFunction, int precision) const
+{
+    if (!d->displayList || d->rasterList || d->async) return;
+    d->flush();
+
+    // replay into a picture with the same settings and a new style state;
+    // style names continue after the ones already used by this picture
+    QTikzPicture picture;
+    QTikzPicturePrivate * target = picture.d;
+    target->setSink(textStream, device, writeFunction, precision);
+    target->copySettings(*d);
+
+    target->replay(*d->displayList);
+    target->flush();
+
+    // the shapes were counted when recorded
+    d->addOutputCounts(target->stats);
+}
+
+QString QTikzPicture::registerColor(const QColor& color)
+{
+    if (d->shared) {
+        // the color definition goes to the recorded picture, ahead of all layers
+        QMutexLocker locker(&d->shared->mutex);
+        return d->shared->colorName(color.rgba());
     }
 
-    return pathList.join("\n");
+    // may write a color definition
+    d->endStream();
+    return d->colorName(color.rgba());
+}
+
+QString QTikzPicture::registerColor(const QColor& color, qreal* opacity)
+{
+    if (opacity) {
+        *opacity = color.alphaF();
+    }
+    return registerColor(color);
+}
+
+void QTikzPicture::setSimplifyTolerance(qreal tolerance)
+{
+    d->writer.simplifyTolerance = qMax(qreal(0), tolerance);
+}
+
+qreal QTikzPicture::simplifyTolerance() const
+{
+    return d->writer.simplifyTolerance;
 }
 
-QString QTikzPicturePrivate::toTikzPath(const QPolygonF & polygon) const
+void QTikzPicture::setRedundantPointRemoval(bool enable)
 {
-    if (polygon.isEmpty()) return QString();
+    d->writer.redundantPointRemoval = enable;
+}
 
-    const int end = polygon.size() - polygon.isClosed() ? 1 : 0;
+bool QTikzPicture::redundantPointRemoval() const
+{
+    return d->writer.redundantPointRemoval;
+}
 
-    QString path;
-    for (int i = 0; i < end; ++i) {
-        if (i == 0) {
-            path = toCoord(polygon[i]);
-        } else if (i == end - 1) {
-            path += " -- cycle";
-        } else {
-            path += " -- " + toCoord(polygon[i]);
-        }
-    }
+void QTikzPicture::setCompactOutput(bool enable)
+{
+    d->writer.compact = enable;
+}
 
-    return path;
+bool QTikzPicture::compactOutput() const
+{
+    return d->writer.compact;
 }
 
-QString QTikzPicturePrivate::toTikzPath(const QRectF & rect) const
+void QTikzPicture::setArcDetection(bool enable)
 {
-    if (rect.isEmpty()) return QString();
+    d->writer.arcDetection = enable;
+}
 
-    const QString path = toCoord(rect.topLeft()) + " rectangle "
-                       + toCoord(rect.bottomRight());
-    return path;
+bool QTikzPicture::arcDetection() const
+{
+    return d->writer.arcDetection;
 }
 
-QString QTikzPicturePrivate::toTikzPath(const QLineF & line) const
+void QTikzPicture::setFlatteningTolerance(qreal tolerance)
 {
-    const QString path = toCoord(line.p1()) + " -- " + toCoord(line.p2());
-    return path;
+    d->writer.flatteningTolerance = qMax(qreal(0), tolerance);
 }
 
-QString QTikzPicturePrivate::toTikzPath(const QPointF & circleCenter, qreal radius) const
+qreal QTikzPicture::flatteningTolerance() const
 {
-    if (radius < 0) return QString();
+    return d->writer.flatteningTolerance;
+}
 
-    QLocale l = QLocale::c();
-    const QString path = toCoord(circleCenter) + " circle (" + l.toString(radius, 'g', precision) + "cm)";
-    return path;
+void QTikzPicture::setThreadCount(int count)
+{
+    d->threadCount = qMax(0, count);
 }
 
-void QTikzPicturePrivate::writePath(const QString & cmd, const QString & options, const QString & path)
+int QTikzPicture::threadCount() const
 {
-    if (! ts) return;
-    if (path.isEmpty()) return;
+    return d->threadCount;
+}
 
-    (*ts) << cmd;
-    if (! options.isEmpty()) {
-        (*ts) << "[" << options << "]";
-    }
-    (*ts) << " " << path << ";\n";
+void QTikzPicture::setPathCache(QTikzPathCache* cache)
+{
+    d->pathCache = cache;
+}
+
+QTikzPathCache* QTikzPicture::pathCache() const
+{
+    return d->pathCache;
+}
+
+void QTikzPicture::setStatsEnabled(bool enable)
+{
+    d->statsEnabled = enable;
+}
+
+bool QTikzPicture::statsEnabled() const
+{
+    return d->statsEnabled;
 }
 
+QTikzStats QTikzPicture::stats() const
+{
+    return d->currentStats();
+}
 
+void QTikzPicture::resetStats()
+{
+    d->stats = QTikzStats();
+}
 
+void QTikzPicture::setTraceFunction(const TraceFunction& traceFunction)
+{
+    d->traceFunction = traceFunction;
+}
 
+void QTikzPicture::setCulling(bool enable)
+{
+    d->culling = enable;
+}
 
+bool QTikzPicture::culling() const
+{
+    return d->culling;
+}
 
+void QTikzPicture::setCullingMargin(qreal margin)
+{
+    d->cullingMargin = qMax(qreal(0), margin);
+}
 
-QTikzPicture::QTikzPicture()
-    : d(new QTikzPicturePrivate())
+qreal QTikzPicture::cullingMargin() const
 {
-    d->ts = 0;
-    d->precision = 2;
+    return d->cullingMargin;
 }
 
-QTikzPicture::~QTikzPicture()
+void QTikzPicture::setClipGeometry(bool enable)
 {
-    delete d;
+    d->clipGeometry = enable;
 }
 
-void QTikzPicture::setStream(QTextStream* textStream, int precision)
+bool QTikzPicture::clipGeometry() const
 {
-    d->ts = textStream;
-    d->precision = qMax(0, precision);
+    return d->clipGeometry;
+}
 
-    if (d->ts) {
-        d->ts->setRealNumberPrecision(precision);
-        d->ts->setRealNumberNotation(QTextStream::FixedNotation);
-    }
+void QTikzPicture::setColorLevels(int levels)
+{
+    d->colorLevels = qBound(0, levels, 256);
 }
 
-QString QTikzPicture::registerColor(const QColor& color)
+int QTikzPicture::colorLevels() const
 {
-    // some predefined colors
-    if (color == Qt::red) return "red";
-    if (color == Qt::green) return "green";
-    if (color == Qt::blue) return "blue";
-    if (color == Qt::black) return "black";
-    if (color == Qt::white) return "white";
-    if (color == Qt::cyan) return "cyan";
-    if (color == Qt::magenta) return "magenta";
-    if (color == Qt::yellow) return "yellow";
+    return d->colorLevels;
+}
 
-    QString name = color.name();
-    if (name.startsWith('#')) name.remove(0, 1);
+void QTikzPicture::setColorTolerance(int tolerance)
+{
+    d->colorTolerance = qMax(0, tolerance);
+}
 
-    name.replace("0", "q", Qt::CaseInsensitive);
-    name.replace("1", "r", Qt::CaseInsensitive);
-    name.replace("2", "s", Qt::CaseInsensitive);
-    name.replace("3", "t", Qt::CaseInsensitive);
-    name.replace("4", "u", Qt::CaseInsensitive);
-    name.replace("5", "v", Qt::CaseInsensitive);
-    name.replace("6", "w", Qt::CaseInsensitive);
-    name.replace("7", "x", Qt::CaseInsensitive);
-    name.replace("8", "y", Qt::CaseInsensitive);
-    name.replace("9", "z", Qt::CaseInsensitive);
+int QTikzPicture::colorTolerance() const
+{
+    return d->colorTolerance;
+}
 
-    name = 'c' + name;
+QString QTikzPicture::registerStyle(const QString& options)
+{
+    d->endStream();
+    if (options.isEmpty()) return QString();
 
-    if (!d->colors.contains(name)) {
-        if (d->ts) {
-            (*d->ts) << "\\definecolor{" << name << "}{rgb}{"
-                  << color.redF() << ", " << color.greenF() << ", " << color.blueF() << "}\n";
+    QTikzOptionEntry & entry = d->optionTable[options];
+    if (d->displayList) {
+        // defined on replay, where the depth of the scopes is known
+        if (entry.style.isEmpty()) {
+            entry.style = d->newStyleName();
         }
-        d->colors[name] = true;
+        QTikzDisplayCommand & command = d->record(QTikzDisplayCommand::Style, PathCommands[0], options);
+        command.first = d->displayList->addString(entry.style);
+    } else if (entry.depth < 0 && d->hasSink()) {
+        d->defineStyle(options, entry);
+        d->sync();
+    } else if (entry.style.isEmpty()) {
+        entry.style = d->newStyleName();
     }
 
-    return name;
+    return entry.style;
+}
+
+void QTikzPicture::setStyleThreshold(int count)
+{
+    d->styleThreshold = qMax(0, count);
+}
+
+int QTikzPicture::styleThreshold() const
+{
+    return d->styleThreshold;
 }
 
 void QTikzPicture::begin(const QString& options)
 {
-    if (!d->ts) return;
+    d->endStream();
+    if (!d->hasSink()) return;
 
     if (options.isEmpty()) {
-        (*d->ts) << "\\begin{tikzpicture}\n";
+        d->write("\\begin{tikzpicture}\n");
     } else {
-        (*d->ts) << "\\begin{tikzpicture}[" << options << "]\n";
+        d->write("\\begin{tikzpicture}[");
+        d->write(options);
+        d->write("]\n");
     }
+    d->openScope();
+    d->sync();
+    d->trace(BeginPicture, ++d->traceDepth);
 }
 
 void QTikzPicture::end()
 {
-    if (!d->ts) return;
+    if (!d->hasSink()) return;
+
+    if (d->rasterList) {
+        d->rasterDepth = 1;
+        endRasterScope();
+    }
+
+    d->endStream();
+    d->write("\\end{tikzpicture}\n");
+    d->closeScope();
+    d->flush();
+    if (d->async) {
+        d->finished = d->submitAsync(true);
+    }
+    if (d->imagePool) {
+        d->imagePool->waitForDone();
+    }
+    d->trace(EndPicture, d->traceDepth);
+    d->traceDepth = qMax(0, d->traceDepth - 1);
+}
+
+QByteArray QTikzPicture::saveState()
+{
+    if (d->async || d->displayList || d->streamKind != QTikzPicturePrivate::NoStream) {
+        return QByteArray();
+    }
+    d->flush();
+
+    QByteArray state;
+    QDataStream out(&state, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+    d->state().write(out);
+    return state;
+}
+
+bool QTikzPicture::resume(QIODevice* device, const QByteArray& state, int precision)
+{
+    if (!device || d->async || d->displayList || d->streamKind != QTikzPicturePrivate::NoStream) {
+        return false;
+    }
+
+    QTikzPictureState saved;
+    QDataStream in(state);
+    in.setVersion(QDataStream::Qt_5_0);
+    if (!saved.read(in) || !device->seek(saved.outputOffset)) {
+        return false;
+    }
+
+    // drop the output written after the state was saved, e.g. by end()
+    if (QFileDevice * file = qobject_cast<QFileDevice *>(device)) {
+        if (!file->resize(saved.outputOffset)) return false;
+    } else if (QBuffer * buffer = qobject_cast<QBuffer *>(device)) {
+        buffer->buffer().truncate(int(saved.outputOffset));
+    } else if (device->size() > saved.outputOffset) {
+        // the trailing output cannot be dropped
+        return false;
+    }
 
-    (*d->ts) << "\\end{tikzpicture}\n";
+    d->setSink(0, device, WriteFunction(), precision);
+    d->setState(saved);
+    return true;
 }
 
 void QTikzPicture::beginScope(const QString& options)
 {
-    if (!d->ts) return;
+    d->endStream();
+    if (!d->hasSink()) return;
+
+    if (d->rasterList) {
+        // the image is placed outside of all scopes, so only the clipping
+        // is local to the scope; its options are neither written nor rendered
+        ++d->rasterScopes;
+        d->openScope();
+        d->trace(BeginScope, ++d->traceDepth);
+        return;
+    }
 
     if (options.isEmpty()) {
-        (*d->ts) << "\\begin{scope}\n";
+        d->write("\\begin{scope}\n");
     } else {
-        (*d->ts) << "\\begin{scope}[" << options << "]\n";
+        d->write("\\begin{scope}[");
+        d->write(options);
+        d->write("]\n");
     }
+    d->openScope(!options.isEmpty());
+    d->sync();
+    d->trace(BeginScope, ++d->traceDepth);
 }
 
 void QTikzPicture::endScope()
 {
-    if (!d->ts) return;
+    d->endStream();
+    if (!d->hasSink()) return;
+
+    if (d->rasterList && d->rasterScopes > 0) {
+        --d->rasterScopes;
+    } else {
+        d->write("\\end{scope}\n");
+    }
+    d->closeScope();
+    d->sync();
+    d->trace(EndScope, d->traceDepth);
+    d->traceDepth = qMax(0, d->traceDepth - 1);
+}
+
+void QTikzPicture::beginRasterScope(qreal dpi)
+{
+    if (!d->hasSink()) return;
+    if (d->rasterList) {
+        ++d->rasterDepth;
+        return;
+    }
+
+    // record the shapes of the scope into a display list of their own
+    d->endStream();
+    d->flush();
+    d->rasterDpi = dpi > 0 ? dpi : 300;
+    d->rasterDepth = 1;
+    d->rasterScopes = 0;
+    d->rasterOuterList = d->displayList;
+    d->rasterList = new QTikzDisplayList;
+    d->displayList = d->rasterList;
+}
+
+void QTikzPicture::endRasterScope()
+{
+    if (!d->rasterList || --d->rasterDepth > 0) return;
+
+    d->endStream();
+    d->flush();
+
+    // close the scopes still open in the raster scope
+    for (; d->rasterScopes > 0; --d->rasterScopes) {
+        d->closeScope();
+        d->trace(EndScope, d->traceDepth);
+        d->traceDepth = qMax(0, d->traceDepth - 1);
+    }
+
+    QTikzDisplayList * list = d->rasterList;
+    d->displayList = d->rasterOuterList;
+    d->rasterList = 0;
+    d->rasterOuterList = 0;
+
+    d->writeRaster(*list);
+    delete list;
+    d->sync();
+}
+
+void QTikzPicture::setImageBaseName(const QString& baseName)
+{
+    d->rasterBaseName = baseName;
+}
 
-    (*d->ts) << "\\end{scope}\n";
+QString QTikzPicture::imageBaseName() const
+{
+    return d->imageBaseName();
 }
 
 void QTikzPicture::newline(int count)
 {
-    if (!d->ts) return;
+    d->endStream();
+    if (!d->hasSink()) return;
 
     for (int i = 0; i < count; ++i) {
-        (*d->ts) << "\n";
+        d->write("\n", 1);
     }
+    d->sync();
 }
 
 void QTikzPicture::comment(const QString& text)
 {
-    if (!d->ts) return;
+    d->endStream();
+    if (!d->hasSink()) return;
 
-    (*d->ts) << "% " << text << "\n";
+    d->write("% ");
+    d->write(text);
+    d->write("\n");
+    d->sync();
 }
 
 void QTikzPicture::path(const QPainterPath& path, const QString& options)
 {
-    d->writePath("\\path", options, d->toTikzPath(path));
+    d->endStream();
+    d->writePath("\\path", options, path);
 }
 
 void QTikzPicture::path(const QRectF& rect, const QString& options)
 {
-    d->writePath("\\path", options, d->toTikzPath(rect));
+    d->endStream();
+    d->writePath("\\path", options, rect);
 }
 
 void QTikzPicture::path(const QPolygonF& polygon, const QString& options)
 {
-    d->writePath("\\path", options, d->toTikzPath(polygon));
+    d->endStream();
+    d->writePath("\\path", options, polygon);
 }
 
 void QTikzPicture::path(const QLineF& line, const QString& options)
 {
-    d->writePath("\\path", options, d->toTikzPath(line));
+    d->endStream();
+    d->writePath("\\path", options, line);
 }
 
 void QTikzPicture::path(const QPointF& p1, const QPointF & p2, const QString& options)
 {
-    d->writePath("\\path", options, d->toTikzPath(QLineF(p1, p2)));
+    d->endStream();
+    d->writePath("\\path", options, QLineF(p1, p2));
 }
 
 void QTikzPicture::path(const QPointF& circleCenter, qreal radius, const QString& options)
 {
-    d->writePath("\\path", options, d->toTikzPath(circleCenter, radius));
+    d->endStream();
+    d->writePath("\\path", options, QTikzCircle(circleCenter, radius));
+}
+
+
+void QTikzPicture::path(const QVector<QRectF>& rects, const QString& options)
+{
+    d->endStream();
+    d->writePaths("\\path", options, rects.size(), [&](int i) { return rects[i]; });
+}
+
+void QTikzPicture::path(const QVector<QLineF>& lines, const QString& options)
+{
+    d->endStream();
+    d->writePaths("\\path", options, lines.size(), [&](int i) { return lines[i]; });
 }
 
 
 void QTikzPicture::draw(const QPainterPath& path, const QString& options)
 {
-    d->writePath("\\draw", options, d->toTikzPath(path));
+    d->endStream();
+    d->writePath("\\draw", options, path);
 }
 
 void QTikzPicture::draw(const QRectF& rect, const QString& options)
 {
-    d->writePath("\\draw", options, d->toTikzPath(rect));
+    d->endStream();
+    d->writePath("\\draw", options, rect);
 }
 
 void QTikzPicture::draw(const QPolygonF& polygon, const QString& options )
 {
-    d->writePath("\\draw", options, d->toTikzPath(polygon));
+    d->endStream();
+    d->writePath("\\draw", options, polygon);
 }
 
 void QTikzPicture::draw(const QLineF& line, const QString& options)
 {
-    d->writePath("\\draw", options, d->toTikzPath(line));
+    d->endStream();
+    d->writePath("\\draw", options, line);
 }
 
 void QTikzPicture::draw(const QPointF& p1, const QPointF & p2, const QString& options)
 {
-    d->writePath("\\draw", options, d->toTikzPath(QLineF(p1, p2)));
+    d->endStream();
+    d->writePath("\\draw", options, QLineF(p1, p2));
 }
 
 void QTikzPicture::draw(const QPointF& circleCenter, qreal radius, const QString& options)
 {
-    d->writePath("\\draw", options, d->toTikzPath(circleCenter, radius));
+    d->endStream();
+    d->writePath("\\draw", options, QTikzCircle(circleCenter, radius));
+}
+
+
+void QTikzPicture::draw(const QVector<QRectF>& rects, const QString& options)
+{
+    d->endStream();
+    d->writePaths("\\draw", options, rects.size(), [&](int i) { return rects[i]; });
+}
+
+void QTikzPicture::draw(const QVector<QLineF>& lines, const QString& options)
+{
+    d->endStream();
+    d->writePaths("\\draw", options, lines.size(), [&](int i) { return lines[i]; });
 }
 
 
 void QTikzPicture::fill(const QPainterPath& path, const QString& options)
 {
-    d->writePath("\\fill", options, d->toTikzPath(path));
+    d->endStream();
+    d->writePath("\\fill", options, path);
 }
 
 void QTikzPicture::fill(const QRectF& rect, const QString& options)
 {
-    d->writePath("\\fill", options, d->toTikzPath(rect));
+    d->endStream();
+    d->writePath("\\fill", options, rect);
 }
 
 void QTikzPicture::fill(const QPolygonF& polygon, const QString& options )
 {
-    d->writePath("\\fill", options, d->toTikzPath(polygon));
+    d->endStream();
+    d->writePath("\\fill", options, polygon);
 }
 
 void QTikzPicture::fill(const QPointF& circleCenter, qreal radius, const QString& options)
 {
-    d->writePath("\\fill", options, d->toTikzPath(circleCenter, radius));
+    d->endStream();
+    d->writePath("\\fill", options, QTikzCircle(circleCenter, radius));
+}
+
+
+void QTikzPicture::fill(const QVector<QRectF>& rects, const QString& options)
+{
+    d->endStream();
+    d->writePaths("\\fill", options, rects.size(), [&](int i) { return rects[i]; });
+}
+
+void QTikzPicture::path(const QPainterPath& path, const QTikzStyle& style)
+{
+    d->endStream();
+    d->writePath("\\path", style, path);
+}
+
+void QTikzPicture::path(const QRectF& rect, const QTikzStyle& style)
+{
+    d->endStream();
+    d->writePath("\\path", style, rect);
+}
+
+void QTikzPicture::path(const QPolygonF& polygon, const QTikzStyle& style)
+{
+    d->endStream();
+    d->writePath("\\path", style, polygon);
+}
+
+void QTikzPicture::path(const QVector<QRectF>& rects, const QTikzStyle& style)
+{
+    d->endStream();
+    d->writePaths("\\path", style, rects.size(), [&](int i) { return rects[i]; });
+}
+
+void QTikzPicture::draw(const QPainterPath& path, const QTikzStyle& style)
+{
+    d->endStream();
+    d->writePath("\\draw", style, path);
+}
+
+void QTikzPicture::draw(const QRectF& rect, const QTikzStyle& style)
+{
+    d->endStream();
+    d->writePath("\\draw", style, rect);
+}
+
+void QTikzPicture::draw(const QPolygonF& polygon, const QTikzStyle& style)
+{
+    d->endStream();
+    d->writePath("\\draw", style, polygon);
+}
+
+void QTikzPicture::draw(const QLineF& line, const QTikzStyle& style)
+{
+    d->endStream();
+    d->writePath("\\draw", style, line);
+}
+
+void QTikzPicture::draw(const QPointF& circleCenter, qreal radius, const QTikzStyle& style)
+{
+    d->endStream();
+    d->writePath("\\draw", style, QTikzCircle(circleCenter, radius));
+}
+
+void QTikzPicture::draw(const QVector<QRectF>& rects, const QTikzStyle& style)
+{
+    d->endStream();
+    d->writePaths("\\draw", style, rects.size(), [&](int i) { return rects[i]; });
+}
+
+void QTikzPicture::draw(const QVector<QLineF>& lines, const QTikzStyle& style)
+{
+    d->endStream();
+    d->writePaths("\\draw", style, lines.size(), [&](int i) { return lines[i]; });
+}
+
+void QTikzPicture::fill(const QPainterPath& path, const QTikzStyle& style)
+{
+    d->endStream();
+    d->writePath("\\fill", style, path);
+}
+
+void QTikzPicture::fill(const QRectF& rect, const QTikzStyle& style)
+{
+    d->endStream();
+    d->writePath("\\fill", style, rect);
+}
+
+void QTikzPicture::fill(const QPolygonF& polygon, const QTikzStyle& style)
+{
+    d->endStream();
+    d->writePath("\\fill", style, polygon);
+}
+
+void QTikzPicture::fill(const QPointF& circleCenter, qreal radius, const QTikzStyle& style)
+{
+    d->endStream();
+    d->writePath("\\fill", style, QTikzCircle(circleCenter, radius));
+}
+
+void QTikzPicture::fill(const QVector<QRectF>& rects, const QTikzStyle& style)
+{
+    d->endStream();
+    d->writePaths("\\fill", style, rects.size(), [&](int i) { return rects[i]; });
 }
 
 
 void QTikzPicture::clip(const QPainterPath& path)
 {
-    d->writePath("\\clip", QString(), d->toTikzPath(path));
+    d->endStream();
+    d->writePath("\\clip", QString(), path);
 }
 
 void QTikzPicture::clip(const QRectF& rect)
 {
-    d->writePath("\\clip", QString(), d->toTikzPath(rect));
+    d->endStream();
+    d->writePath("\\clip", QString(), rect);
+}
+
+
+void QTikzPicture::circle(const QPointF& center, qreal radius, const QString& options)
+{
+    d->endStream();
+    d->writePath("\\draw", options, QTikzCircle(center, radius));
+}
+
+void QTikzPicture::circles(const QVector<QPointF>& centers, qreal radius, const QString& options)
+{
+    d->endStream();
+    d->writePaths("\\draw", options, centers.size(),
+                  [&](int i) { return QTikzCircle(centers[i], radius); });
+}
+
+void QTikzPicture::circles(const QVector<QPointF>& centers, const QVector<qreal>& radii, const QString& options)
+{
+    d->endStream();
+    d->writePaths("\\draw", options, qMin(centers.size(), radii.size()),
+                  [&](int i) { return QTikzCircle(centers[i], radii[i]); });
+}
+
+
+bool QTikzPicture::defineSymbol(const QString& name, const QPainterPath& path, const QString& options)
+{
+    static const char invalid[] = "/,={}[]%#\\";
+    if (name.isEmpty() || path.isEmpty()) return false;
+    for (int i = 0; i < name.size(); ++i) {
+        if (name[i].unicode() < 0x80 && strchr(invalid, name[i].unicode())) return false;
+    }
+
+    // symbols placed so far keep the previous definition
+    if (d->async && !d->rasterList) {
+        d->submitAsync(false);
+    }
+
+    QTikzSymbol symbol;
+    symbol.path = path;
+    symbol.options = options;
+    symbol.bounds = d->bounds(path);
+    symbol.revision = ++d->symbolRevision;
+    d->setSymbol(name, symbol);
+    d->symbolsChanged = true;
+    return true;
+}
+
+void QTikzPicture::placeSymbol(const QString& name, const QPointF& position)
+{
+    d->endStream();
+    d->placeSymbols(name, &position, 1);
 }
 
+void QTikzPicture::placeSymbols(const QString& name, const QVector<QPointF>& positions)
+{
+    d->endStream();
+    d->placeSymbols(name, positions.constData(), positions.size());
+}
 
 void QTikzPicture::line(const QVector<QPointF>& points, const QString& options)
 {
-    if (!d->ts || points.size() < 2) return;
+    d->endStream();
+    d->writeLine(points.constData(), points.size(), options);
+}
+
+bool QTikzPicture::lineFromFile(const QString& fileName, qint64 offset, qint64 count, const QString& options)
+{
+    d->endStream();
+    QFile file(fileName);
+    if (offset < 0 || !file.open(QIODevice::ReadOnly)) return false;
+
+    const qint64 pointSize = 2 * sizeof(double);
+    const qint64 available = (file.size() - offset) / pointSize;
+    if (available < 0 || count > available) return false;
+    if (count < 0) {
+        count = available;
+    }
+
+    // convert block by block, the data may be unaligned
+    QVector<QPointF> block(FileBlockPoints);
+    auto addBlocks = [&](const uchar * data, qint64 points) {
+        for (qint64 first = 0; first < points; first += FileBlockPoints) {
+            const int size = int(qMin(qint64(FileBlockPoints), points - first));
+            const uchar * bytes = data + first * pointSize;
+            for (int i = 0; i < size; ++i) {
+                double xy[2];
+                memcpy(xy, bytes + i * pointSize, sizeof(xy));
+                block[i] = QPointF(xy[0], xy[1]);
+            }
+            addPoints(block.constData(), size);
+        }
+    };
+
+    beginLine(options);
+    bool ok = true;
+    QByteArray readBuffer;
+    for (qint64 first = 0; first < count && ok; first += FileWindowPoints) {
+        const qint64 points = qMin(FileWindowPoints, count - first);
+        const qint64 position = offset + first * pointSize;
+
+        uchar * data = file.map(position, points * pointSize);
+        if (data) {
+            addBlocks(data, points);
+            file.unmap(data);
+            continue;
+        }
+
+        // files that cannot be mapped are read block by block
+        ok = file.seek(position);
+        readBuffer.resize(int(FileBlockPoints * pointSize));
+        for (qint64 done = 0; done < points && ok; done += FileBlockPoints) {
+            const qint64 size = qMin(qint64(FileBlockPoints), points - done);
+            ok = file.read(readBuffer.data(), size * pointSize) == size * pointSize;
+            if (ok) {
+                addBlocks(reinterpret_cast<const uchar *>(readBuffer.constData()), size);
+            }
+        }
+    }
+    endLine();
+
+    return ok;
+}
+
+void QTikzPicture::setMaxPathPoints(int count)
+{
+    d->maxPathPoints = qMax(0, count);
+}
+
+int QTikzPicture::maxPathPoints() const
+{
+    return d->maxPathPoints;
+}
+
+void QTikzPicture::beginLine(const QString& options)
+{
+    d->beginStream(QTikzPicturePrivate::LineStream, options);
+}
+
+void QTikzPicture::addPoints(const QPointF* points, int count)
+{
+    d->addStreamPoints(points, count);
+}
+
+void QTikzPicture::addPoints(const QVector<QPointF>& points)
+{
+    d->addStreamPoints(points.constData(), points.size());
+}
+
+void QTikzPicture::endLine()
+{
+    d->endStream();
+}
+
+void QTikzPicture::beginPath(const QString& options)
+{
+    d->beginStream(QTikzPicturePrivate::PathStream, options);
+}
+
+void QTikzPicture::moveTo(const QPointF& point)
+{
+    d->addStreamElement(QPainterPath::MoveToElement, point);
+}
+
+void QTikzPicture::lineTo(const QPointF& point)
+{
+    d->addStreamElement(QPainterPath::LineToElement, point);
+}
+
+void QTikzPicture::cubicTo(const QPointF& c1, const QPointF& c2, const QPointF& endPoint)
+{
+    d->addStreamElement(QPainterPath::CurveToElement, c1);
+    d->addStreamElement(QPainterPath::CurveToDataElement, c2);
+    d->addStreamElement(QPainterPath::CurveToDataElement, endPoint);
+}
 
-    (*d->ts) << "\\draw";
-    if (!options.isEmpty()) {
-        (*d->ts) << "[" << options << "]";
+void QTikzPicture::closeSubpath()
+{
+    if (d->streamKind != QTikzPicturePrivate::PathStream || !d->hasStreamPoint || !d->hasSink()) return;
+
+    if (d->displayList) {
+        // recorded like QPainterPath, i.e. as line to the start of the subpath
+        if (d->streamPoint != d->streamSubpathStart) {
+            d->addStreamElement(QPainterPath::LineToElement, d->streamSubpathStart);
+        }
+        return;
     }
-    const int size = points.size();
-    for (int i = 0; i < size - 1; ++i) {
-        (*d->ts) << " (" << points[i].x() << ", " << points[i].y() << ") --";
+
+    if (d->statsEnabled) {
+        ++d->stats.elements;
     }
-    (*d->ts) << " (" << points[size-1].x() << ", " << points[size-1].y() << ");\n";
+    d->writer.flushLineTo();
+    d->writer.writeCycle();
+    d->streamPoint = d->streamSubpathStart;
+    d->sync();
+}
+
+void QTikzPicture::endPath()
+{
+    d->endStream();
 }
 
 QTikzPicture& QTikzPicture::operator<< (const QString& text)
 {
-    if (!d->ts || text.isEmpty()) return *this;
-    (*d->ts) << text;
+    d->endStream();
+    if (!d->hasSink() || text.isEmpty()) return *this;
+    d->write(text);
+    d->sync();
     return *this;
 }
 
 QTikzPicture& QTikzPicture::operator<< (const char* text)
 {
-    return operator<<(QString(text));
+    d->endStream();
+    if (!d->hasSink() || !text) return *this;
+    d->write(text);
+    d->sync();
+    return *this;
+}
+
+QTikzPicture& QTikzPicture::operator<< (QLatin1String text)
+{
+    d->endStream();
+    if (!d->hasSink() || text.size() == 0) return *this;
+    d->write(text);
+    d->sync();
+    return *this;
 }
 
 QTikzPicture& QTikzPicture::operator<< (double number)
 {
-    if (d->ts) (*d->ts) << number;
+    d->endStream();
+    if (!d->hasSink()) return *this;
+    d->writeNumber(number);
+    d->sync();
     return *this;
 }
 
 QTikzPicture& QTikzPicture::operator<< (int number)
 {
-    if (d->ts) (*d->ts) << number;
+    d->endStream();
+    if (!d->hasSink()) return *this;
+    char buffer[NumberBufferSize];
+    d->write(buffer, formatInteger(buffer, number));
+    d->sync();
     return *this;
 }
 
@@ -28,11 +28,16 @@
 #ifndef QT_TIKZ_PICTURE_H
 #define QT_TIKZ_PICTURE_H
 
+#include <QtCore/QByteArray>
 #include <QtCore/QHash>
 #include <QtCore/QString>
 #include <QtCore/QVector>
 
+#include <functional>
+#include <cstddef>
+
 class QTextStream;
+class QIODevice;
 class QColor;
 class QPointF;
 class QPolygonF;
@@ -40,6 +45,103 @@ class QRectF;
 class QLineF;
 class QPainterPath;
 class QTikzPicturePrivate;
+class QTikzPathCache;
+class QTikzPathCachePrivate;
+class QTikzRecorderPrivate;
+class QTikzBatchExporterPrivate;
+class QTikzStyle;
+
+/**
+ * @brief Drawing options prepared for repeated use.
+ *
+ * Drawing options passed as QString are encoded to UTF-8 on every drawing
+ * call. A QTikzStyle encodes its options once, together with the path
+ * commands, so that drawing calls with the style copy the command and its
+ * options as a whole, e.g.
+ * @code
+ * \draw[thin, gray]
+ * @endcode
+ * followed by the coordinates:
+ * \code
+ * const QTikzStyle grid(QStringLiteral("thin, gray"));
+ * for (int i = 0; i < lines.size(); ++i) {
+ *     tikzPicture.draw(lines[i], grid);
+ * }
+ * \endcode
+ *
+ * If options are promoted to TikZ styles, see registerStyle() and
+ * setStyleThreshold(), the options of a QTikzStyle are looked up like
+ * any other options. QTikzStyle is a value type and may be shared by
+ * several pictures and threads.
+ */
+class QTikzStyle
+{
+public:
+    /**
+     * Create a style without options.
+     */
+    QTikzStyle();
+
+    /**
+     * Create a style for the drawing @p options.
+     */
+    explicit QTikzStyle(const QString& options);
+
+    /**
+     * Returns the drawing options of the style.
+     */
+    const QString& options() const;
+
+private:
+    friend class QTikzPicturePrivate;
+
+    QString opts;
+
+    // the commands \path, \draw, \fill and \clip with the options
+    QByteArray prefixes[4];
+};
+
+/**
+ * @brief Statistics of the output of a QTikzPicture.
+ *
+ * Collected if enabled with QTikzPicture::setStatsEnabled(). Shapes are
+ * counted when they are passed to QTikzPicture, including shapes that
+ * are culled later on. The times are wall clock times in nanoseconds.
+ */
+struct QTikzStats
+{
+    QTikzStats();
+
+    /** Adds all counters and times of @p other. */
+    QTikzStats& operator+=(const QTikzStats& other);
+
+    /** Shapes written with path(). */
+    quint64 paths;
+    /** Shapes written with draw(), except circles. */
+    quint64 draws;
+    /** Shapes written with fill(), except circles. */
+    quint64 fills;
+    /** Shapes written with clip(). */
+    quint64 clips;
+    /** Circles, drawn or filled. */
+    quint64 circles;
+    /** Polylines of line(), lineFromFile() and beginLine(). */
+    quint64 lines;
+    /** Points of polylines and polygons. */
+    quint64 points;
+    /** Elements of painter paths, including streamed paths. */
+    quint64 elements;
+    /** Bytes of output, including output not yet handed to the sink. */
+    quint64 bytes;
+    /** Distinct colors defined by registerColor(). */
+    quint64 colors;
+    /** Symbols placed with placeSymbol() and placeSymbols(). */
+    quint64 symbols;
+    /** Time spent in formatting the output of the drawing calls. */
+    qint64 formatTime;
+    /** Time spent in writing to the output sink. */
+    qint64 writeTime;
+};
 
 /**
  * @brief Export drawing primitives to PGF/TikZ.
@@ -86,28 +188,463 @@ class QTikzPicturePrivate;
  *
  * tikzPicture.path(path, "fill=green!50, draw=green!50!black");
  *
- * // 5. end tikzpicture
+ * // 5. end tikzpicture, before the file and text stream are destroyed
  * tikzPicture.end();
  * \endcode
  *
+ * Since TikZ output is plain ASCII, you can also skip the QTextStream
+ * and write the encoded bytes directly to a QIODevice with setDevice()
+ * or to your own callback with setWriteFunction().
+ *
  * @author Dominik Haumann \<dhaumann@kde.org\>
  */
 class QTikzPicture
 {
+public:
+    /**
+     * Callback type for setWriteFunction(). The function receives
+     * @p size bytes of UTF-8 encoded output starting at @p data.
+     */
+    typedef std::function<void (const char* data, size_t size)> WriteFunction;
+
+    /**
+     * Events passed to the TraceFunction.
+     */
+    enum TraceEvent {
+        /** begin() was called. */
+        BeginPicture,
+        /** end() was called, all output is handed to the sink. */
+        EndPicture,
+        /** beginScope() was called. */
+        BeginScope,
+        /** endScope() was called. */
+        EndScope
+    };
+
+    /**
+     * Callback type for setTraceFunction(). The function receives the
+     * @p event, the nesting @p depth of the picture or scope, with 1 for
+     * the picture itself, and the statistics at the time of the event.
+     */
+    typedef std::function<void (TraceEvent event, int depth, const QTikzStats& stats)> TraceFunction;
+
 public:
     QTikzPicture();
+
+    /**
+     * Destroys the picture. Call end() before the stream, device or write
+     * function is destroyed, since only output that is already buffered
+     * for the sink is written here. Commands recorded in retained mode
+     * are dropped, and the asynchronous mode only waits for the chunks
+     * queued so far.
+     */
     virtual ~QTikzPicture();
 
     /**
      * Set the output text stream to @p textStream.
      * Optionally, a precision of floating point numbers can specified.
-     * A value of 2 implies numbers in the format '2.34'.
+     * The precision is the number of significant digits, i.e. a value of
+     * 3 implies numbers in the format '2.34'.
      *
      * @param textStream output text stream, must be a valid pointer
-     * @param precision floating poing precision
+     * @param precision floating point precision
      */
     void setStream(QTextStream* textStream, int precision = 2);
 
+    /**
+     * Write the output as UTF-8 encoded bytes to @p device instead of
+     * a QTextStream. This avoids the text codec of QTextStream entirely.
+     * The output is buffered internally and written to @p device once
+     * the buffer size is reached and in end() or flush().
+     *
+     * @param device output device, must be open for writing
+     * @param precision floating point precision, see setStream()
+     */
+    void setDevice(QIODevice* device, int precision = 2);
+
+    /**
+     * Write the output gzip compressed to @p device, e.g. for archiving.
+     * The output is compressed in chunks of the buffer size, see
+     * setBufferSize(), so the uncompressed output is never held in memory
+     * as a whole. Each chunk is written as a gzip member of its own, which
+     * gunzip and zcat decompress as a single file. Larger buffers compress
+     * slightly better. The output starts with an empty member, so that
+     * the device holds a valid gzip file even without any output.
+     *
+     * In asynchronous mode, the output is compressed on a thread of its
+     * own, in parallel to its formatting, see setAsyncMode().
+     *
+     * @param device output device, must be open for writing
+     * @param level compression level from 0 (none) to 9 (best), or -1
+     *        for the default of zlib
+     * @param precision floating point precision, see setStream()
+     */
+    void setCompressedDevice(QIODevice* device, int level = -1, int precision = 2);
+
+    /**
+     * Hand the output as UTF-8 encoded bytes to @p writeFunction.
+     * The output is buffered internally and passed to @p writeFunction
+     * in chunks once the buffer size is reached and in end() or flush().
+     *
+     * @param writeFunction function receiving the output
+     * @param precision floating point precision, see setStream()
+     */
+    void setWriteFunction(const WriteFunction& writeFunction, int precision = 2);
+
+    /**
+     * Set the size of the internal output buffer to @p size bytes.
+     * Once the buffered output reaches this size, it is handed out to the
+     * device or write function. The default is 64 KiB.
+     *
+     * @param size buffer size in bytes
+     */
+    void setBufferSize(int size);
+
+    /**
+     * Returns the size of the internal output buffer in bytes.
+     */
+    int bufferSize() const;
+
+    /**
+     * Hand out all buffered output to the stream, device or write function.
+     * This happens automatically in end().
+     *
+     * In retained mode, the display list is written to the stream, device
+     * or write function and cleared. In asynchronous mode, this waits until
+     * the worker thread has written all output.
+     */
+    void flush();
+
+    /**
+     * Enable or disable the asynchronous mode. In asynchronous mode, the
+     * drawing calls only record compact binary commands, as in retained
+     * mode. Chunks of recorded commands are queued for a worker thread,
+     * which formats them and writes the output to the stream, device or
+     * write function, so the calling thread does not wait on I/O.
+     *
+     * At most @p queueSize chunks wait for the worker. Once the queue is
+     * full, drawing calls block until the worker has caught up, so that
+     * the memory use stays bounded. end() only queues the rest of the
+     * picture, use isFinished() or waitForFinished() to find out when it
+     * has been written completely.
+     *
+     * The worker takes over the current settings of the picture, later
+     * changes of the precision, culling, simplification etc. have no
+     * effect until the asynchronous mode is disabled again. The output
+     * stream, device or write function must not be used by any other
+     * thread until the output has been written, and cannot be changed in
+     * asynchronous mode. The counters of the output in stats() are updated
+     * by flush() and when disabling the mode.
+     *
+     * The asynchronous mode cannot be combined with the retained mode, and
+     * is not changed within a raster scope. Disabling it calls flush().
+     *
+     * @param enable if @e true, format and write on a worker thread
+     * @param queueSize maximum amount of chunks waiting for the worker
+     */
+    void setAsyncMode(bool enable, int queueSize = 8);
+
+    /**
+     * Returns whether the output is formatted and written on a worker thread.
+     * @see setAsyncMode()
+     */
+    bool asyncMode() const;
+
+    /**
+     * Enable or disable the retained mode. In retained mode, all calls
+     * are recorded in a display list of compact binary commands instead
+     * of being written. Geometry is stored with full precision, and styles
+     * are promoted only when the display list is written, so the same
+     * display list can be written many times, with different precisions,
+     * using writeTo().
+     *
+     * Literal output, e.g. comments or text written with the << operators,
+     * is recorded as text. Disabling the retained mode calls flush().
+     * By default, the retained mode is disabled.
+     *
+     * @param retained if @e true, record calls in a display list
+     */
+    void setRetainedMode(bool retained);
+
+    /**
+     * Returns whether calls are recorded in a display list.
+     * @see setRetainedMode()
+     */
+    bool retainedMode() const;
+
+    /**
+     * Write the display list of the retained mode to @p textStream with
+     * @p precision significant digits. The display list is kept, so it can
+     * be written again. The other settings, e.g. the simplify tolerance or
+     * the style threshold, are the ones of this picture.
+     *
+     * @param textStream output text stream, must be a valid pointer
+     * @param precision floating point precision, see setStream()
+     * @see setRetainedMode()
+     */
+    void writeTo(QTextStream* textStream, int precision = 2) const;
+
+    /**
+     * This function is an overload and writes to @p device, see setDevice().
+     */
+    void writeTo(QIODevice* device, int precision = 2) const;
+
+    /**
+     * This function is an overload and writes to @p writeFunction,
+     * see setWriteFunction().
+     */
+    void writeTo(const WriteFunction& writeFunction, int precision = 2) const;
+
+    /**
+     * Simplify polygonal geometry before writing it. Points that deviate
+     * less than @p tolerance from the simplified geometry are removed
+     * with the Douglas-Peucker algorithm. This applies to line(), polygons
+     * and runs of straight lines in painter paths, curves are written
+     * unchanged. The @p tolerance is given in output units, i.e. in the
+     * coordinate system of the written coordinates.
+     *
+     * Dense data such as time series often contains far more points than
+     * visible in the final figure, so a small tolerance considerably
+     * reduces both the file size and the TeX compilation time.
+     *
+     * A value of 0 disables the simplification, which is the default.
+     *
+     * @param tolerance maximum deviation in output units
+     */
+    void setSimplifyTolerance(qreal tolerance);
+
+    /**
+     * Returns the tolerance of the geometric simplification.
+     * @see setSimplifyTolerance()
+     */
+    qreal simplifyTolerance() const;
+
+    /**
+     * Write cubic curves of painter paths that approximate circular arcs
+     * with the arc syntax of TikZ, e.g. QPainterPath::addEllipse() and
+     * arcTo(). Consecutive curves on the same circle are merged:
+     * @code
+     * \draw (1, 0) arc (0:90:1cm) -- (0, 2);
+     * @endcode
+     * Closed subpaths forming a whole circle or axis-aligned ellipse are
+     * written as 'circle' or 'ellipse' if they run counterclockwise, which
+     * is the orientation TikZ uses for these.
+     *
+     * Curves are converted only if they deviate from the arc by less than
+     * the rounding of their coordinates to the output precision, and if
+     * the end point TikZ computes from the written angles and radius is as
+     * accurate. Note that TeX computes arcs with about five significant
+     * digits, so higher precisions gain nothing here. Disabled by default.
+     *
+     * @param enable whether to detect arcs
+     */
+    void setArcDetection(bool enable);
+
+    /**
+     * Returns whether arcs are detected in painter paths.
+     * @see setArcDetection()
+     */
+    bool arcDetection() const;
+
+    /**
+     * Flatten small cubic curves of painter paths. Curves which deviate
+     * less than @p tolerance from a polyline of at most three segments are
+     * written as that polyline, which is shorter than the curve and
+     * cheaper for TeX. The @p tolerance is given in output units, as for
+     * setSimplifyTolerance(). Arcs found by setArcDetection() are written
+     * as arcs instead.
+     *
+     * A value of 0 disables the flattening, which is the default.
+     *
+     * @param tolerance maximum deviation in output units
+     */
+    void setFlatteningTolerance(qreal tolerance);
+
+    /**
+     * Returns the tolerance of the curve flattening.
+     * @see setFlatteningTolerance()
+     */
+    qreal flatteningTolerance() const;
+
+    /**
+     * Remove points that are redundant at the output precision. If enabled,
+     * consecutive points of line(), polygons and painter paths that are
+     * identical after rounding to the precision set in setStream() are
+     * written only once, and points lying exactly on the straight line
+     * between their neighbors are dropped.
+     *
+     * In contrast to setSimplifyTolerance(), this is lossless: the written
+     * geometry is the same at the chosen precision.
+     * Disabled by default.
+     *
+     * @param enable enable the removal of redundant points
+     */
+    void setRedundantPointRemoval(bool enable);
+
+    /**
+     * Returns whether redundant points are removed.
+     * @see setRedundantPointRemoval()
+     */
+    bool redundantPointRemoval() const;
+
+    /**
+     * Write paths in a compact syntax, meant for large pictures that are
+     * not read by humans. If enabled, points of line segments are written as
+     * relative coordinates '++(dx,dy)' whenever these are shorter than the
+     * absolute ones, and the spaces in coordinates and around '--' as well
+     * as the line breaks between subpaths are omitted.
+     *
+     * The relative coordinates are computed exactly from the rounded
+     * values, so the written geometry is the same at the chosen precision.
+     * Disabled by default.
+     *
+     * @param enable enable the compact output
+     */
+    void setCompactOutput(bool enable);
+
+    /**
+     * Returns whether paths are written in the compact syntax.
+     * @see setCompactOutput()
+     */
+    bool compactOutput() const;
+
+    /**
+     * Enable or disable the culling of invisible geometry. If enabled,
+     * rects, circles, lines, polygons and paths whose bounding box is
+     * completely outside the current clip rectangle are not written.
+     * The clip rectangle is the intersection of the bounding boxes of all
+     * clip() calls in the current scope and its enclosing scopes, and
+     * it is restored in endScope(). Since scope options may transform the
+     * coordinates, a scope begun with options starts without a clip
+     * rectangle. Clipping written literally, e.g. with the << operators,
+     * is not taken into account.
+     *
+     * By default, culling is disabled.
+     *
+     * @param enable if @e true, skip geometry outside the clip rectangle
+     */
+    void setCulling(bool enable);
+
+    /**
+     * Returns whether geometry outside the clip rectangle is skipped.
+     * @see setCulling()
+     */
+    bool culling() const;
+
+    /**
+     * Grow the clip rectangle by @p margin for culling and geometric
+     * clipping. Since strokes extend beyond the geometry by half of the
+     * line width, choose at least half of the widest line width, in
+     * picture coordinates, to keep strokes next to the clip rectangle.
+     * The default is 0.
+     *
+     * @param margin margin in picture coordinates
+     */
+    void setCullingMargin(qreal margin);
+
+    /**
+     * Returns the margin of the clip rectangle.
+     * @see setCullingMargin()
+     */
+    qreal cullingMargin() const;
+
+    /**
+     * Enable or disable the geometric clipping of polylines and polygons.
+     * If enabled together with setCulling(), line() only writes the parts
+     * of the polyline within the clip rectangle, as subpaths of a single
+     * path, and polygons are clipped to the clip rectangle. Note that
+     * a clipped polygon gets new edges along the clip rectangle, so for
+     * drawn polygons, set a culling margin of at least half of the line
+     * width; see setCullingMargin().
+     *
+     * By default, geometric clipping is disabled.
+     *
+     * @param enable if @e true, clip polylines and polygons
+     */
+    void setClipGeometry(bool enable);
+
+    /**
+     * Returns whether polylines and polygons are clipped.
+     * @see setClipGeometry()
+     */
+    bool clipGeometry() const;
+
+    /**
+     * Serialize large painter paths on @p count threads. Paths with many
+     * subpaths, e.g. contour maps, are split at their subpaths into chunks,
+     * which are converted to TikZ in parallel and written in their original
+     * order. The output is identical to the serial output.
+     *
+     * Painter paths with less than 16384 elements, and paths consisting of
+     * a single subpath, are always serialized on the calling thread.
+     * A value of 0 uses QThread::idealThreadCount() threads. The default
+     * is 1, i.e. no worker threads.
+     *
+     * @param count amount of threads
+     */
+    void setThreadCount(int count);
+
+    /**
+     * Returns the amount of threads used to serialize painter paths.
+     * @see setThreadCount()
+     */
+    int threadCount() const;
+
+    /**
+     * Look up painter paths in @p cache before converting them to TikZ,
+     * and add the output of paths not found. Pass 0 to disable the cache,
+     * which is the default. The cache is not owned by the picture and has
+     * to outlive it.
+     *
+     * @param cache path cache, may be shared with other pictures
+     * @see QTikzPathCache
+     */
+    void setPathCache(QTikzPathCache* cache);
+
+    /**
+     * Returns the path cache of this picture, or 0 if there is none.
+     * @see setPathCache()
+     */
+    QTikzPathCache* pathCache() const;
+
+    /**
+     * Collect statistics about the output, see stats(). Counting costs
+     * little, but measuring the times queries the clock twice for each
+     * drawing call. Disabled by default.
+     *
+     * @param enable enable collecting statistics
+     */
+    void setStatsEnabled(bool enable);
+
+    /**
+     * Returns whether statistics are collected.
+     * @see setStatsEnabled()
+     */
+    bool statsEnabled() const;
+
+    /**
+     * Returns the statistics collected while enabled, since the last call
+     * of resetStats(). In retained mode, shapes are counted when recorded,
+     * and bytes and times when written with writeTo().
+     */
+    QTikzStats stats() const;
+
+    /**
+     * Reset all statistics to zero.
+     */
+    void resetStats();
+
+    /**
+     * Call @p traceFunction on begin(), end(), beginScope() and endScope(),
+     * e.g. to attribute the export time to the layers of a scene drawn
+     * in separate scopes. The function is called after the output of the
+     * call has been written, and receives the current stats(). Pass an
+     * empty function to remove the callback.
+     *
+     * @param traceFunction the callback
+     */
+    void setTraceFunction(const TraceFunction& traceFunction);
+
     /**
      * PGF/TikZ knows predefined colors such as 'red', 'green' etc.
      * If you want to use arbitrary QColors, you first need to create
@@ -122,11 +659,109 @@ public:
      *
      * Calling this function for the same color multiple times is
      * supported and returns always the same unique identifier.
+     * Repeated calls are cheap: a single hash lookup without allocation.
+     *
+     * As PGF/TikZ colors have no alpha channel, a translucent color
+     * returns the identifier of its opaque color. Use the overload below
+     * to obtain its opacity.
      *
      * @param color the color to register
      */
     QString registerColor(const QColor& color);
 
+    /**
+     * Register @p color as above, and return its alpha channel in
+     * @p opacity, to be passed as opacity option where needed:
+     * @code
+     * qreal opacity;
+     * QString col = tikzPicture.registerColor(QColor(100, 200, 0, 128), &opacity);
+     * tikzPicture.fill(rect, "fill=" + col + ", fill opacity=" + QString::number(opacity));
+     * @endcode
+     *
+     * @param color the color to register
+     * @param opacity receives the opacity from 0 to 1, or a null pointer
+     */
+    QString registerColor(const QColor& color, qreal* opacity);
+
+    /**
+     * Limit the amount of colors defined by registerColor(). With @p levels
+     * greater than 1, each color channel is snapped to @p levels evenly
+     * spaced values, so at most levels^3 colors are defined, no matter how
+     * many different colors are registered. This is useful for continuous
+     * color maps, which otherwise define a color for each value.
+     *
+     * A value of 0 disables the palette, which is the default.
+     *
+     * @param levels amount of values per color channel
+     */
+    void setColorLevels(int levels);
+
+    /**
+     * Returns the amount of values per color channel.
+     * @see setColorLevels()
+     */
+    int colorLevels() const;
+
+    /**
+     * Reuse already defined colors in registerColor(). If a newly registered
+     * color is within @p tolerance of a defined color, the identifier of
+     * the nearest defined color is returned instead of defining a new one.
+     * The distance is the euclidean distance of the RGB values in the
+     * range 0 to 255.
+     *
+     * A value of 0 disables the reuse, which is the default.
+     *
+     * @param tolerance maximum color distance
+     */
+    void setColorTolerance(int tolerance);
+
+    /**
+     * Returns the maximum distance for reusing defined colors.
+     * @see setColorTolerance()
+     */
+    int colorTolerance() const;
+
+    /**
+     * Define a TikZ style for the drawing @p options and return its name.
+     * The style is written as
+     * @code
+     * \tikzset{s1/.style={draw=red, thin}}
+     * @endcode
+     * and can be used in all following drawing options:
+     * @code
+     * QString style = tikzPicture.registerStyle("draw=red, thin");
+     * tikzPicture.path(path, style + ", dashed");
+     * @endcode
+     *
+     * Further drawing calls with exactly the same @p options automatically
+     * refer to the style. As \tikzset is local to the current scope, styles
+     * registered within a scope must not be used after endScope().
+     *
+     * @param options the drawing options to define a style for
+     */
+    QString registerStyle(const QString& options);
+
+    /**
+     * Automatically promote drawing options to styles. Once the same
+     * options string is used @p count times, it is defined as TikZ style
+     * (see registerStyle()), and all further drawing calls refer to the
+     * short style name. This reduces the file size and speeds up the
+     * TeX compilation if the same options are used over and over again.
+     *
+     * Styles defined within a scope are defined again when used after the
+     * scope ended. A value of 0 disables the automatic promotion, which
+     * is the default.
+     *
+     * @param count amount of uses before options are promoted to a style
+     */
+    void setStyleThreshold(int count);
+
+    /**
+     * Returns the amount of uses before options are promoted to a style.
+     * @see setStyleThreshold()
+     */
+    int styleThreshold() const;
+
     /**
      * Calling begin() is required before calling the first painting
      * routine. A call of begin() with optional @p options creates a new TikZ
@@ -147,10 +782,30 @@ public:
      * @code
      * \end{tikzpicture}
      * @endcode
-     * to the output text stream. Therefore, call this function only once.
+     * to the output text stream and flushes all buffered output.
+     * Therefore, call this function only once.
+     *
+     * In asynchronous mode, the output is still written by the worker
+     * thread when end() returns, see waitForFinished().
      */
     void end();
 
+    /**
+     * Returns whether all output of end() is handed to the stream, device
+     * or write function. This is the case right after end(), unless the
+     * asynchronous mode is enabled.
+     * @see waitForFinished(), setAsyncMode()
+     */
+    bool isFinished() const;
+
+    /**
+     * Wait until all output of end() is handed to the stream, device or
+     * write function. Returns right away unless the asynchronous mode is
+     * enabled.
+     * @see isFinished(), setAsyncMode()
+     */
+    void waitForFinished();
+
     /**
      * Calling begin() with optional @p options creates a new TikZ
      * scope in terms of
@@ -172,6 +827,112 @@ public:
      */
     void endScope();
 
+    /**
+     * Returns a checkpoint of the picture, so that its output can be
+     * continued later, e.g. for a picture of a long running simulation.
+     * The state contains the open scopes, the registered colors, styles
+     * and symbols, and the position in the output. Pending output is
+     * handed out first.
+     *
+     * Typically, the state is saved before the final endScope() and end()
+     * calls, and the output is continued with resume() at that position,
+     * overwriting the trailing lines. The output written before is neither
+     * formatted nor written again.
+     *
+     * Settings such as the precision, style threshold and prefix, or the
+     * color levels are not part of the state, so set them again for
+     * identical output. The state is empty in retained or asynchronous
+     * mode, within a raster scope and while a line or path is streamed.
+     *
+     * @return the state to pass to resume()
+     */
+    QByteArray saveState();
+
+    /**
+     * Continue the output of a picture on @p device at the position of
+     * the @p state returned by saveState(). All output written after that
+     * position is dropped: a QFileDevice or a QBuffer is truncated, other
+     * devices have to end at that position. The device must be open,
+     * e.g. a QFile opened with QIODevice::ReadWrite, and contain the output
+     * of the saved picture at the same offsets. The output of a QTextStream
+     * or of setCompressedDevice() cannot be continued.
+     *
+     * @param device output device, must support seek()
+     * @param state state of the picture returned by saveState()
+     * @param precision floating point precision, see setStream()
+     * @return @e true on success, @e false for an invalid @p state or
+     *         if the device cannot seek or be truncated; the picture is
+     *         unchanged then
+     */
+    bool resume(QIODevice* device, const QByteArray& state, int precision = 2);
+
+    /**
+     * Start a raster scope for dense content such as scatter plots with
+     * millions of markers, which take long for TeX to process as vector
+     * graphics. All shapes drawn until endRasterScope() are rendered with
+     * QPainter into an image of @p dpi dots per inch instead, which is
+     * written as PNG file and placed with a single
+     * @code
+     * \node at (x, y) {\includegraphics[width=..., height=...]{image.png}};
+     * @endcode
+     * at the bounding box of the shapes.
+     *
+     * For rendering, only the following keys of the shape options are
+     * interpreted, all other options are ignored:
+     * - @e draw and @e fill, optionally with a color or @e none, and
+     *   @e color, which sets both colors;
+     * - a color name without key, which sets both colors as well;
+     * - @e opacity, @e draw @e opacity and @e fill @e opacity;
+     * - @e line @e width with the unit pt, bp, mm, cm or in, and
+     *   @e ultra @e thin to @e ultra @e thick;
+     * - @e even @e odd @e rule and @e nonzero @e rule;
+     * - the names of styles of registerStyle() and of promoted options,
+     *   expanded up to 8 levels.
+     *
+     * Colors are registered, predefined or xcolor names, or mixtures such
+     * as 'red!50!blue'. Option values must not contain commas.
+     * Coordinates are taken as centimeters, as in TikZ without scaling
+     * options. Comments, color and style definitions are written as usual.
+     * Since the image is placed after them, outside of any scope, scopes
+     * begun within a raster scope are not written and their options are
+     * not rendered; only the clipping of clip() is local to them. Raster
+     * scopes do not nest, an inner pair of calls has no effect. In a
+     * raster scope, flush(), writeTo() and setRetainedMode() do nothing.
+     *
+     * The image is encoded on a worker thread, end() waits until all
+     * images are written.
+     *
+     * @param dpi resolution of the image in dots per inch
+     * @see setImageBaseName()
+     */
+    void beginRasterScope(qreal dpi = 300);
+
+    /**
+     * Ends a raster scope started with beginRasterScope(), renders its
+     * shapes and writes the node referencing the image.
+     */
+    void endRasterScope();
+
+    /**
+     * Set the file name of the images of raster scopes to @p baseName
+     * followed by '-raster1.png', '-raster2.png' etc. The name is used
+     * as is in \includegraphics, so a relative path has to be relative to
+     * the directory LaTeX is run in.
+     *
+     * By default, the output file name without suffix is used if the
+     * output device is a QFile, e.g. 'picture-raster1.png' for the output
+     * file 'picture.tikz', and 'qtikzpicture' otherwise.
+     *
+     * @param baseName file name of the images without suffix
+     */
+    void setImageBaseName(const QString& baseName);
+
+    /**
+     * Returns the file name of the images of raster scopes without suffix.
+     * @see setImageBaseName()
+     */
+    QString imageBaseName() const;
+
     /**
      * Insert @p count newline characters.
      * You can use this to manually structure your TikZ picture.
@@ -235,17 +996,70 @@ public:
     void path(const QPointF& p1, const QPointF & p2, const QString& options = QString());
     void path(const QPointF& circleCenter, qreal radius, const QString& options = QString());
 
+    /**
+     * Write all rectangles in @p rects as a single path to the output stream.
+     * This is much faster than calling path() for each rectangle, since
+     * the command and the @p options are written only once.
+     * Empty rectangles are skipped.
+     *
+     * Example output:
+     * @code
+     * \path[fill=green] (0, 0) rectangle (1, 1)
+     *     (2, 0) rectangle (3, 1);
+     * @endcode
+     *
+     * @param rects rectangles to draw
+     * @param options optional drawing options
+     */
+    void path(const QVector<QRectF>& rects, const QString& options = QString());
+
+    /**
+     * Write all lines in @p lines as a single path to the output stream.
+     * See path(const QVector<QRectF>&, const QString&) for details.
+     *
+     * @param lines lines to draw
+     * @param options optional drawing options
+     */
+    void path(const QVector<QLineF>& lines, const QString& options = QString());
+
     void draw(const QPainterPath& path, const QString& options = QString());
     void draw(const QRectF& rect, const QString& options = QString());
     void draw(const QPolygonF& polygon, const QString& options = QString());
     void draw(const QLineF& line, const QString& options = QString());
     void draw(const QPointF& p1, const QPointF & p2, const QString& options = QString());
     void draw(const QPointF& circleCenter, qreal radius, const QString& options = QString());
+    void draw(const QVector<QRectF>& rects, const QString& options = QString());
+    void draw(const QVector<QLineF>& lines, const QString& options = QString());
 
     void fill(const QPainterPath& path, const QString& options = QString());
     void fill(const QRectF& rect, const QString& options = QString());
     void fill(const QPolygonF& polygon, const QString& options = QString());
     void fill(const QPointF& circleCenter, qreal radius, const QString& options = QString());
+    void fill(const QVector<QRectF>& rects, const QString& options = QString());
+
+    /**
+     * Overloads of path(), draw() and fill() with options prepared once
+     * in a QTikzStyle. The output is identical to passing the options as
+     * string, but the command and its options are copied as a whole.
+     */
+    void path(const QPainterPath& path, const QTikzStyle& style);
+    void path(const QRectF& rect, const QTikzStyle& style);
+    void path(const QPolygonF& polygon, const QTikzStyle& style);
+    void path(const QVector<QRectF>& rects, const QTikzStyle& style);
+
+    void draw(const QPainterPath& path, const QTikzStyle& style);
+    void draw(const QRectF& rect, const QTikzStyle& style);
+    void draw(const QPolygonF& polygon, const QTikzStyle& style);
+    void draw(const QLineF& line, const QTikzStyle& style);
+    void draw(const QPointF& circleCenter, qreal radius, const QTikzStyle& style);
+    void draw(const QVector<QRectF>& rects, const QTikzStyle& style);
+    void draw(const QVector<QLineF>& lines, const QTikzStyle& style);
+
+    void fill(const QPainterPath& path, const QTikzStyle& style);
+    void fill(const QRectF& rect, const QTikzStyle& style);
+    void fill(const QPolygonF& polygon, const QTikzStyle& style);
+    void fill(const QPointF& circleCenter, qreal radius, const QTikzStyle& style);
+    void fill(const QVector<QRectF>& rects, const QTikzStyle& style);
 
     /**
      * Clip according to the painter path specified in @p path.
@@ -282,6 +1096,72 @@ public:
      */
     void circle(const QPointF& center, qreal radius, const QString& options = QString());
 
+    /**
+     * Draw circles with radius @p radius at all @p centers as a single path.
+     * This is much faster than calling circle() for each circle, since
+     * the command and the @p options are written only once.
+     *
+     * @param centers centers of the circles
+     * @param radius radius of all circles
+     * @param options optional drawing options
+     */
+    void circles(const QVector<QPointF>& centers, qreal radius, const QString& options = QString());
+
+    /**
+     * Draw circles at @p centers with the corresponding @p radii as a
+     * single path. Surplus entries of the longer vector are ignored.
+     *
+     * @param centers centers of the circles
+     * @param radii radii of the circles
+     * @param options optional drawing options
+     */
+    void circles(const QVector<QPointF>& centers, const QVector<qreal>& radii, const QString& options = QString());
+
+    /**
+     * Define the symbol @p name with the geometry @p path and @p options,
+     * for markers or glyphs that are placed many times. The path is
+     * converted once and written as TikZ pic, which requires TikZ 3.0:
+     * @code
+     * \tikzset{name/.pic={\path[options] (-0.1, 0) -- (0.1, 0);}}
+     * @endcode
+     * The pic is defined right before the first placeSymbol() or
+     * placeSymbols(), and again after the scope of its definition has been
+     * closed. Defining an existing symbol replaces it. In retained mode,
+     * placed symbols use the definition at the time the picture is written.
+     *
+     * Symbols are local to this picture, the layers of a QTikzRecorder
+     * have symbols of their own.
+     *
+     * @param name name of the pic, must not contain any of '/,={}[]%#\'
+     * @param path geometry of the symbol relative to its position
+     * @param options drawing options of the symbol
+     * @return false if @p name is invalid or @p path is empty
+     */
+    bool defineSymbol(const QString& name, const QPainterPath& path, const QString& options = QString());
+
+    /**
+     * Place the symbol @p name of defineSymbol() at @p position.
+     * Only the position is written, e.g.
+     * @code
+     * \path (2, 1) pic {name};
+     * @endcode
+     * Unknown symbols are ignored.
+     *
+     * @param name symbol name
+     * @param position position of the symbol
+     */
+    void placeSymbol(const QString& name, const QPointF& position);
+
+    /**
+     * Place the symbol @p name of defineSymbol() at all @p positions as a
+     * single path. With culling, symbols outside of the clip rectangle are
+     * skipped. In a raster scope, the symbols are rendered into the image.
+     *
+     * @param name symbol name
+     * @param positions positions of the symbols
+     */
+    void placeSymbols(const QString& name, const QVector<QPointF>& positions);
+
     /**
      * Draw the polygonal line @p points with optional @p options.
      *
@@ -290,6 +1170,119 @@ public:
      */
     void line(const QVector<QPointF>& points, const QString& options = QString());
 
+    /**
+     * Draw the polygonal line stored in the binary file @p fileName with
+     * optional @p options. The file contains pairs of doubles x, y in the
+     * native byte order. Starting at byte @p offset, @p count points are
+     * read, or all remaining points if @p count is negative.
+     *
+     * The file is mapped into memory window by window and streamed through
+     * beginLine() and addPoints(), so even very large files are exported
+     * with a small resident set. Files that cannot be mapped are read.
+     *
+     * Returns @e false if the file cannot be opened or read, or if it
+     * contains less than @p count points after @p offset.
+     *
+     * @param fileName binary file with x, y pairs of doubles
+     * @param offset offset of the first point in bytes
+     * @param count amount of points, or -1 for all points
+     * @param options optional drawing options
+     */
+    bool lineFromFile(const QString& fileName, qint64 offset = 0, qint64 count = -1,
+                      const QString& options = QString());
+
+    /**
+     * Split polylines with more than @p count points into several path
+     * commands, each continuing at the last point of the previous one.
+     * TeX reads a path command at once, so very long paths may exceed its
+     * input buffer or main memory. This applies to line() and beginLine().
+     * A value of 0, the default, disables splitting.
+     *
+     * @param count maximum amount of points per path command
+     */
+    void setMaxPathPoints(int count);
+
+    /**
+     * Returns the maximum amount of points per path command.
+     * @see setMaxPathPoints()
+     */
+    int maxPathPoints() const;
+
+    /**
+     * Begin a polyline with optional @p options, whose points are passed
+     * in chunks with addPoints(). Each chunk is written right away, so
+     * the polyline never has to be in memory as a whole:
+     * \code
+     * tikzPicture.beginLine("thin");
+     * while (reader.hasSamples()) {
+     *     const QVector<QPointF> chunk = reader.readSamples(4096);
+     *     tikzPicture.addPoints(chunk);
+     * }
+     * tikzPicture.endLine();
+     * \endcode
+     *
+     * The output is the same as for line(), except that culling, clipping
+     * and simplification work per chunk, i.e. the points at the end of
+     * each chunk are always kept. Any other call writing output, e.g.
+     * draw() or beginScope(), ends the polyline first.
+     *
+     * @param options optional drawing options
+     */
+    void beginLine(const QString& options = QString());
+
+    /**
+     * Add the @p count points @p points to the polyline of beginLine().
+     */
+    void addPoints(const QPointF* points, int count);
+
+    /**
+     * This function is an overload and provided for convenience.
+     */
+    void addPoints(const QVector<QPointF>& points);
+
+    /**
+     * End the polyline started with beginLine().
+     */
+    void endLine();
+
+    /**
+     * Begin a path with optional @p options, whose elements are passed with
+     * moveTo(), lineTo(), cubicTo() and closeSubpath(). As for path(),
+     * the options decide whether the path is drawn or filled. The elements
+     * are written right away, so the path never has to be in memory as a
+     * whole. Streamed paths are neither culled nor split. Any other call
+     * writing output ends the path first.
+     *
+     * @param options optional drawing options
+     */
+    void beginPath(const QString& options = QString());
+
+    /**
+     * Start a new subpath of the path of beginPath() at @p point.
+     */
+    void moveTo(const QPointF& point);
+
+    /**
+     * Add a straight line to @p point to the path of beginPath().
+     */
+    void lineTo(const QPointF& point);
+
+    /**
+     * Add a cubic Bezier curve with the control points @p c1 and @p c2
+     * ending at @p endPoint to the path of beginPath().
+     */
+    void cubicTo(const QPointF& c1, const QPointF& c2, const QPointF& endPoint);
+
+    /**
+     * Close the current subpath of the path of beginPath().
+     */
+    void closeSubpath();
+
+    /**
+     * End the path started with beginPath().
+     */
+    void endPath();
+
     /**
      * For convenience, use the << operator to write @p text directly to the output
      * stream. This gives full control over the text written to the TikZ picture.
@@ -303,10 +1296,17 @@ public:
      */
     QTikzPicture& operator<< (const char* text);
 
+    /**
+     * This function is an overload and provided for convenience.
+     * Like the const char* overload, @p text is written without
+     * constructing a QString.
+     */
+    QTikzPicture& operator<< (QLatin1String text);
+
     /**
      * This operator writes the floating point number @p number directly
-     * to the output stream. The value of @p number is rounded according
-     * to the precision set in setStream().
+     * to the output stream. The value of @p number is rounded to the
+     * amount of significant digits set in setStream().
      *
      * @param number number to write
      */
@@ -322,9 +1322,254 @@ public:
     QTikzPicture& operator<< (int number);
 
 private:
+    void writeTo(QTextStream* textStream, QIODevice* device,
+                 const WriteFunction& writeFunction, int precision) const;
+
+    friend class QTikzRecorder;
+    friend class QTikzBatchExporterPrivate;
     QTikzPicturePrivate * const d;
 };
 
+/**
+ * @brief Cache of painter paths converted to TikZ.
+ *
+ * Scenes often write the same painter paths, e.g. legend glyphs, axis
+ * ticks or map outlines, into many pictures. Pictures using a path cache,
+ * see QTikzPicture::setPathCache(), keep the output of recently written
+ * paths, so writing a path again only copies its output:
+ * \code
+ * QTikzPathCache cache;
+ * for (int i = 0; i < pictures.size(); ++i) {
+ *     pictures[i]->setPathCache(&cache);
+ *     pictures[i]->draw(outline);   // converted only once
+ * }
+ * \endcode
+ *
+ * Paths are looked up by their elements and the settings affecting the
+ * output: precision, simplification tolerance, redundant point removal,
+ * compact output, arc detection and curve flattening. The least recently
+ * used paths are dropped once the output kept exceeds maxSize().
+ *
+ * The cache is thread-safe and may be shared by any number of pictures,
+ * including the layers of a QTikzRecorder.
+ */
+class QTikzPathCache
+{
+public:
+    /**
+     * Create a cache keeping at most @p maxSize bytes of output.
+     */
+    explicit QTikzPathCache(int maxSize = 16 * 1024 * 1024);
+
+    ~QTikzPathCache();
+
+    /**
+     * Set the maximum amount of output kept to @p size bytes. Paths with
+     * more output than that are never cached.
+     */
+    void setMaxSize(int size);
+
+    /**
+     * Returns the maximum amount of output kept in bytes.
+     * @see setMaxSize()
+     */
+    int maxSize() const;
+
+    /**
+     * Returns the amount of output currently kept in bytes.
+     */
+    int size() const;
+
+    /**
+     * Remove all paths from the cache.
+     */
+    void clear();
+
+private:
+    QTikzPathCache(const QTikzPathCache &);
+    QTikzPathCache & operator=(const QTikzPathCache &);
+
+    friend class QTikzPicturePrivate;
+    QTikzPathCachePrivate * const d;
+};
+
+/**
+ * @brief Record into a QTikzPicture from several threads.
+ *
+ * QTikzPicture itself is not thread-safe. QTikzRecorder hands out one
+ * layer per key instead, which is a QTikzPicture recording into its own
+ * buffer with the settings of the recorded picture. Different layers
+ * can be drawn on concurrently, each from a single thread at a time:
+ * \code
+ * QTikzRecorder recorder(tikzPicture);
+ *
+ * // in worker thread i
+ * QTikzPicture & layer = recorder.layer(i);
+ * layer.fill(rect, "fill=" + layer.registerColor(color));
+ *
+ * // after all workers finished
+ * recorder.commit();
+ * \endcode
+ *
+ * commit() appends all layers to the recorded picture in ascending
+ * order of their keys, so the document order does not depend on the
+ * thread scheduling.
+ *
+ * Colors registered in a layer are registered in the recorded picture
+ * under a lock, and their definitions are written to the recorded
+ * picture immediately, i.e. ahead of all layers. Styles are defined
+ * per layer and named after the key of the layer. The recorded picture
+ * must not be used directly until commit() returns.
+ */
+class QTikzRecorder
+{
+public:
+    /**
+     * Record layers for @p picture.
+     */
+    explicit QTikzRecorder(QTikzPicture & picture);
+
+    /**
+     * Commits all pending layers, see commit().
+     */
+    ~QTikzRecorder();
+
+    /**
+     * Returns the layer with the given @p key, creating it on first use.
+     * This function is thread-safe. The returned picture must only be used
+     * by one thread at a time, and is deleted by commit().
+     *
+     * @param key sort key of the layer
+     */
+    QTikzPicture & layer(int key);
+
+    /**
+     * Writes all layers to the recorded picture in ascending order of
+     * their keys and deletes them. Do not call this while layers are
+     * still being recorded.
+     */
+    void commit();
+
+private:
+    QTikzRecorder(const QTikzRecorder &);
+    QTikzRecorder & operator=(const QTikzRecorder &);
+
+    QTikzRecorderPrivate * const d;
+};
+
+/**
+ * @brief Export many pictures in parallel, with shared colors and styles.
+ *
+ * Each figure is written to a file of its own by a thread pool. The
+ * figures share a registry(), a QTikzPicture without picture environment
+ * writing to a common preamble file: colors registered in any figure and
+ * styles registered in the registry are defined once in the preamble,
+ * which is included ahead of all figures:
+ * \code
+ * QTikzBatchExporter exporter("preamble.tikz", 3);
+ * exporter.registry().setStyleThreshold(4);
+ * const QString axis = exporter.registry().registerStyle("draw=gray, thin");
+ *
+ * for (int i = 0; i < plots.size(); ++i) {
+ *     exporter.exportFigure(QString("plot%1.tikz").arg(i), [&, i](QTikzPicture & figure) {
+ *         figure.draw(plots[i].frame, axis);
+ *         figure.draw(plots[i].curve, "draw=" + figure.registerColor(plots[i].color));
+ *     });
+ * }
+ * exporter.finish();
+ * \endcode
+ *
+ * The figures are written with the settings of the registry, e.g. its
+ * precision, style threshold and path cache, and use the registered
+ * styles automatically. The registry must not be changed while figures
+ * are exported.
+ */
+class QTikzBatchExporter
+{
+public:
+    /**
+     * Callback type for exportFigure(). The function draws the @p figure
+     * between its begin() and end(), on a thread of the pool.
+     */
+    typedef std::function<void (QTikzPicture& figure)> DrawFunction;
+
+    /**
+     * Export figures, writing the shared colors and styles to the file
+     * @p preambleFileName.
+     *
+     * @param preambleFileName file the shared definitions are written to
+     * @param precision floating point precision, see QTikzPicture::setStream()
+     */
+    explicit QTikzBatchExporter(const QString& preambleFileName, int precision = 2);
+
+    /**
+     * Waits for all figures, see finish().
+     */
+    ~QTikzBatchExporter();
+
+    /**
+     * Returns the picture holding the shared colors and styles. Its
+     * settings are used for all figures.
+     */
+    QTikzPicture& registry();
+
+    /**
+     * Export figures on @p count threads. A value of 0 uses
+     * QThread::idealThreadCount() threads, which is the default.
+     */
+    void setThreadCount(int count);
+
+    /**
+     * Returns the amount of threads exporting figures.
+     * @see setThreadCount()
+     */
+    int threadCount() const;
+
+    /**
+     * Queue a figure, written to the file @p fileName by @p draw. The
+     * figure is a picture environment with the optional @p options.
+     * This function is thread-safe.
+     *
+     * @param fileName file the figure is written to
+     * @param draw function drawing the figure
+     * @param options options of the picture environment
+     */
+    void exportFigure(const QString& fileName, const DrawFunction& draw,
+                      const QString& options = QString());
+
+    /**
+     * Waits until all queued figures are written, and hands out the
+     * preamble.
+     *
+     * @return @e true if all files were written, @e false otherwise
+     */
+    bool finish();
+
+    /**
+     * Returns the amount of figures written so far.
+     */
+    int figureCount() const;
+
+    /**
+     * Returns the sum of the statistics of all figures written so far.
+     * The times are summed up over all threads.
+     */
+    QTikzStats stats() const;
+
+    /**
+     * Returns the wall clock time in nanoseconds from the first call of
+     * exportFigure() until the last figure was written, e.g. to compute
+     * the aggregate throughput of stats().bytes per second.
+     */
+    qint64 elapsedTime() const;
+
+private:
+    QTikzBatchExporter(const QTikzBatchExporter &);
+    QTikzBatchExporter & operator=(const QTikzBatchExporter &);
+
+    QTikzBatchExporterPrivate * const d;
+};
+
 #endif // QT_TIKZ_PICTURE_H
 
 // kate: replace-tabs on; indent-width 4;
@@ -0,0 +1,21 @@
+# Include this file into a qmake project to build QTikzPicture with it:
+#   include(path/to/src/qtikzpicture.pri)
+
+INCLUDEPATH += $$PWD
+
+HEADERS += \
+    $$PWD/qtikzpicture.h \
+    $$PWD/qtikzpicture_p.h \
+    $$PWD/qtikzasync_p.h \
+    $$PWD/qtikzclip_p.h \
+    $$PWD/qtikzcompressor_p.h \
+    $$PWD/qtikzpathcache_p.h
+
+SOURCES += \
+    $$PWD/qtikzpicture.cpp \
+    $$PWD/qtikzasync.cpp \
+    $$PWD/qtikzbatchexporter.cpp \
+    $$PWD/qtikzclip.cpp \
+    $$PWD/qtikzcompressor.cpp \
+    $$PWD/qtikzpathcache.cpp \
+    $$PWD/qtikzrecorder.cpp
@@ -0,0 +1,573 @@
+/*  Copyright (c) 2012-2013, Dominik Haumann <dhaumann@kde.org>
+    All rights reserved.
+
+    License: FreeBSD License
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef QT_TIKZ_PICTURE_P_H
+#define QT_TIKZ_PICTURE_P_H
+
+#include "qtikzpicture.h"
+#include "qtikzclip_p.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QPainterPath>
+#include <QPointF>
+#include <QPolygonF>
+#include <QRectF>
+#include <QLineF>
+#include <QColor>
+#include <QAtomicInt>
+#include <QMutex>
+
+#include <future>
+
+class QThreadPool;
+class QTikzCompressor;
+class QTikzAsyncPipeline;
+struct QTikzPictureState;
+struct QTikzRasterNames;
+
+/**
+ * A floating point number rounded to a fixed amount of significant digits.
+ * The rounded value equals digits * 10^(exponent - digitCount + 1), where
+ * trailing zeros are already stripped from @p digits.
+ */
+struct QTikzDecimal
+{
+    enum Kind { Finite, Infinite, NaN };
+
+    qint64 digits;
+    int digitCount;
+    int exponent;
+    bool negative;
+    Kind kind;
+};
+
+/**
+ * A point with both coordinates rounded for output.
+ */
+struct QTikzQuantizedPoint
+{
+    QTikzDecimal x;
+    QTikzDecimal y;
+};
+
+/**
+ * A circle given by its center and radius, see QTikzPicturePrivate::writePath().
+ */
+struct QTikzCircle
+{
+    QTikzCircle(const QPointF & c, qreal r) : center(c), radius(r) {}
+
+    QPointF center;
+    qreal radius;
+};
+
+/**
+ * Open addressing hash table mapping QRgb values to indexes of
+ * registered colors. A lookup is a single multiplication and usually
+ * one probe, and it never allocates.
+ */
+class QTikzColorTable
+{
+public:
+    QTikzColorTable() : count(0), shift(32 - 6) { slots.resize(64); clear(); }
+
+    // returns the index stored for @p key, or -1
+    inline int value(QRgb key) const;
+    void insert(QRgb key, int index);
+    void clear();
+
+    // calls @p function with the key and index of each entry
+    template <typename Function>
+    void forEach(Function function) const
+    {
+        for (int i = 0; i < slots.size(); ++i) {
+            if (slots[i].index >= 0) {
+                function(slots[i].key, slots[i].index);
+            }
+        }
+    }
+
+private:
+    struct Slot
+    {
+        QRgb key;
+        int index;  // -1 for empty slots
+    };
+
+    inline uint bucket(QRgb key) const
+    {
+        // Fibonacci hashing, the slot count is 2^(32 - shift)
+        return (key * 2654435769u) >> shift;
+    }
+
+    QVector<Slot> slots;
+    int count;
+    int shift;
+};
+
+class QTikzPicturePrivate;
+
+/**
+ * Writes geometry as TikZ path into a byte buffer. QTikzPicture writes
+ * through one writer into its output buffer, the parallel serialization
+ * of painter paths uses a separate writer per chunk.
+ */
+class QTikzPathWriter
+{
+public:
+    QTikzPathWriter(QByteArray & buffer, QTikzPicturePrivate * owner);
+
+    void copySettings(const QTikzPathWriter & other);
+
+    // output buffer, handed out to the owner's sink once it is full
+    QByteArray & buffer;
+    QTikzPicturePrivate * owner;
+
+    int precision;
+
+    // decimal exponents of the last x and y coordinate, see quantize()
+    mutable int xExponentHint;
+    mutable int yExponentHint;
+
+    // geometric simplification
+    qreal simplifyTolerance;
+    QVector<QPointF> runBuffer;
+    QVector<QPointF> simplifyBuffer;
+    QVector<char> keepBuffer;
+    QVector<int> rangeStack;
+
+    // lossless removal of duplicate and collinear points
+    bool redundantPointRemoval;
+    QTikzQuantizedPoint anchorPoint;   // last written point
+    QTikzQuantizedPoint pendingPoint;  // next point, not yet written
+    bool hasPendingPoint;
+
+    // points of writePolyline(), rounded block by block
+    QVector<QTikzQuantizedPoint> quantizeBuffer;
+
+    // compact output with relative coordinates and without indentation
+    bool compact;
+    int relativePoints;  // relative points written since the last absolute one
+
+    // arcs and flattening of the cubic curves of painter paths
+    bool arcDetection;
+    qreal flatteningTolerance;
+
+public:
+    inline int toCoord(char * buffer, const QPointF & pt) const;
+    inline int toCoord(char * buffer, const QTikzQuantizedPoint & pt) const;
+    inline QTikzQuantizedPoint quantize(const QPointF & pt) const;
+
+    inline void write(const char * data, int size);
+    inline void write(const char * text);
+    inline void write(const QString & text);
+    inline void write(QLatin1String text);
+    inline void writeNumber(double number);
+    inline void writeCoord(const QPointF & pt);
+    inline void writeCoord(const QTikzQuantizedPoint & pt);
+
+    void writeStartPoint(const QPointF & pt);
+    void writeStartPoint(const QTikzQuantizedPoint & pt);
+    inline void writeLineTo(const QPointF & pt);
+    void addLineTo(const QPointF & pt);
+    void addLineTo(const QTikzQuantizedPoint & pt);
+    inline void flushLineTo();
+    void writeLineToCoord(const QTikzQuantizedPoint & pt);
+    inline void writeCycle();
+    inline void writeSubpathSeparator();
+
+    const QPointF * simplified(const QPointF * points, int & count);
+    void writePolyline(const QPointF * points, int count);
+
+    void writeTikzPath(const QPainterPath & path);
+    void writeTikzPath(const QPainterPath & path, int begin, int end);
+    int writeEllipse(const QPainterPath & path, int begin, int end);
+    int writeArc(const QPainterPath & path, int begin, int end, int subpathStart);
+    int writeFlattened(const QPainterPath & path, int begin, int subpathStart);
+    void writeTikzPath(const QPolygonF & polygon);
+    void writeTikzPath(const QRectF & rect);
+    void writeTikzPath(const QLineF & line);
+    void writeTikzPath(const QTikzCircle & circle);
+};
+
+/**
+ * Usage information of an option string, see QTikzPicturePrivate::options().
+ */
+struct QTikzOptionEntry
+{
+    QTikzOptionEntry() : count(0), depth(-1) {}
+
+    int count;      // number of uses so far
+    int depth;      // scope depth of the style definition, -1 if undefined
+    QString style;  // style name, empty if never promoted to a style
+};
+
+/**
+ * A symbol of QTikzPicture::defineSymbol(), written as TikZ pic.
+ */
+struct QTikzSymbol
+{
+    QTikzSymbol() : settings(0), depth(-1), revision(0) {}
+
+    QPainterPath path;
+    QString options;
+    QTikzBounds bounds;     // of path, for culling
+    QByteArray definition;  // the \tikzset defining the pic, empty if not converted
+    quint64 settings;       // settingsFingerprint() of the writer of definition
+    int depth;              // scope depth of the definition, -1 if undefined
+    quint64 revision;       // changes with each defineSymbol()
+};
+
+/**
+ * A command recorded in retained mode. Geometry is stored as a range of
+ * values in the coordinate arena of the display list.
+ */
+struct QTikzDisplayCommand
+{
+    enum Type {
+        Text,           // texts[string]
+        Color,          // color definition of strings[string], rgba in first
+        Style,          // registerStyle() of the options strings[string] as strings[first]
+        OpenScope,      // count is 1 if the scope has options
+        CloseScope,
+        Rect,           // count rects, 4 values each
+        Line,           // count lines, 4 values each
+        Circle,         // count circles, 3 values each
+        Polygon,        // count points, 2 values each
+        PainterPath,    // count elements, 3 values each: type, x, y
+        Polyline,       // count points of line(), 2 values each
+        Symbol          // count positions of symbol strings[string], 2 values each
+    };
+
+    quint8 type;
+    quint8 path;    // index in PathCommands
+    int string;     // options, text, color or symbol name, -1 for none
+    int first;      // first value in the arena
+    int count;
+};
+
+/**
+ * Commands recorded by QTikzPicture in retained mode.
+ */
+class QTikzDisplayList
+{
+public:
+    QVector<QTikzDisplayCommand> commands;
+    QVector<double> values;
+
+    // options and color names, each stored once
+    QVector<QString> strings;
+    QHash<QString, int> stringIndexes;
+
+    // literal output, e.g. comments or text written with operator<<
+    QVector<QByteArray> texts;
+
+public:
+    void clear();
+    int addString(const QString & string);
+    void addText(const QByteArray & text);
+    QTikzDisplayCommand & addCommand(QTikzDisplayCommand::Type type, const char * cmd, const QString & options);
+
+    static QTikzDisplayCommand::Type shapeType(const QRectF &) { return QTikzDisplayCommand::Rect; }
+    static QTikzDisplayCommand::Type shapeType(const QLineF &) { return QTikzDisplayCommand::Line; }
+    static QTikzDisplayCommand::Type shapeType(const QTikzCircle &) { return QTikzDisplayCommand::Circle; }
+    static QTikzDisplayCommand::Type shapeType(const QPolygonF &) { return QTikzDisplayCommand::Polygon; }
+    static QTikzDisplayCommand::Type shapeType(const QPainterPath &) { return QTikzDisplayCommand::PainterPath; }
+
+    // append the values of a shape, returns the amount to add to the command count
+    int appendShape(const QRectF & rect);
+    int appendShape(const QLineF & line);
+    int appendShape(const QTikzCircle & circle);
+    int appendShape(const QPolygonF & polygon);
+    int appendShape(const QPainterPath & path);
+    int appendPoints(const QPointF * points, int count);
+};
+
+/**
+ * Private data class for QTikzPicture.
+ */
+class QTikzPicturePrivate
+{
+public:
+    // output sinks, at most one of them is set
+    QTextStream* ts;
+    QIODevice* device;
+    QTikzPicture::WriteFunction writeFunction;
+    QTikzCompressor * compressor;   // behind writeFunction, see setCompressedDevice()
+    qint64 outputOffset;            // of the output handed out so far, see saveState()
+
+    // ASCII/UTF-8 output collected until flush()
+    QByteArray buffer;
+    int bufferSize;
+
+    // registered colors: names by index, and the index by QRgb
+    QVector<QString> colorNames;
+    QTikzColorTable colorTable;
+
+    // defined opaque colors, used to look up the nearest color
+    QVector<QRgb> paletteColors;
+    QVector<int> paletteIndexes;
+    int colorLevels;
+    int colorTolerance;
+
+    // option interning and styles
+    QHash<QString, QTikzOptionEntry> optionTable;
+    QVector<QString> styleStack;
+    int styleThreshold;
+    int styleCount;
+    QAtomicInt * sharedStyleCount;  // shared with the worker in asynchronous mode, 0 otherwise
+    int scopeDepth;
+    QString stylePrefix;
+
+    // symbols of defineSymbol(), defined just like styles
+    QHash<QString, QTikzSymbol> symbols;
+    QVector<QString> symbolStack;
+    quint64 symbolRevision;
+    bool symbolsChanged;        // since the last chunk of the asynchronous mode
+
+    // formats all geometry into the output buffer
+    QTikzPathWriter writer;
+
+    // worker threads for the serialization of large painter paths
+    int threadCount;
+    QThreadPool * threadPool;
+
+    // output of painter paths written before, not owned
+    QTikzPathCache * pathCache;
+
+    // layers of a QTikzRecorder register their colors in the recorded
+    // picture, guarded by its mutex
+    QTikzPicturePrivate * shared;
+    QMutex mutex;
+
+    // commands recorded in retained mode, 0 otherwise
+    QTikzDisplayList * displayList;
+
+    // worker formatting and writing the output in asynchronous mode, 0 otherwise
+    QTikzAsyncPipeline * async;
+    std::shared_future<void> finished;  // output of the last end() in asynchronous mode
+
+    // culling against the clip rectangle of the current scope
+    bool culling;
+    qreal cullingMargin;
+    QTikzBounds clipBounds;
+    QVector<QTikzBounds> clipStack;
+
+    // geometric clipping of polylines and polygons
+    bool clipGeometry;
+    QVector<QPointF> clipBuffer;
+    QVector<int> pieceBuffer;
+    QVector<quint8> outcodeBuffer;
+    QPolygonF clipPolygonBuffer;
+    QPolygonF clipScratchBuffer;
+
+    // streamed polyline or path, see beginLine() and beginPath()
+    enum StreamKind { NoStream, LineStream, PathStream };
+    StreamKind streamKind;
+    QString streamOptions;
+    bool streamStarted;         // the path command has been written
+    bool hasStreamPoint;        // streamPoint is valid
+    bool streamPointWritten;    // streamPoint is the current point of the output
+    QPointF streamPoint;        // last point of the polyline, or current point of the path
+    QPointF streamSubpathStart;
+    int streamPoints;           // points written in the current path command
+    QVector<QPointF> streamBuffer;
+    QVector<double> streamValues;  // in retained mode, recorded by endStream()
+    int maxPathPoints;
+
+    // instrumentation, see QTikzPicture::stats()
+    bool statsEnabled;
+    QTikzStats stats;
+    bool timing;                // a QTikzStatsTimer is running
+    QTikzPicture::TraceFunction traceFunction;
+    int traceDepth;             // open pictures and scopes, also in retained mode
+
+    // raster scope, see beginRasterScope()
+    QTikzDisplayList * rasterList;       // commands of the open raster scope, 0 otherwise
+    QTikzDisplayList * rasterOuterList;  // display list outside of the raster scope
+    int rasterDepth;
+    int rasterScopes;                    // scopes begun in the raster scope, not written
+    qreal rasterDpi;
+    int rasterCount;                     // images written so far
+    QString rasterBaseName;
+    QThreadPool * imagePool;
+
+public:
+    QTikzPicturePrivate()
+        : sharedStyleCount(0), symbolRevision(0), symbolsChanged(false)
+        , writer(buffer, this), threadCount(1), threadPool(0), pathCache(0), shared(0), displayList(0), async(0)
+        , culling(false), cullingMargin(0), clipGeometry(false)
+        , streamKind(NoStream), streamStarted(false), hasStreamPoint(false), streamPointWritten(false)
+        , streamPoints(0), maxPathPoints(0), statsEnabled(false), timing(false), traceDepth(0)
+        , rasterList(0), rasterOuterList(0), rasterDepth(0), rasterScopes(0), rasterDpi(0), rasterCount(0), imagePool(0)
+    {}
+    ~QTikzPicturePrivate();
+
+    inline bool hasSink() const;
+    void setSink(QTextStream * textStream, QIODevice * outputDevice,
+                 const QTikzPicture::WriteFunction & function, int precision);
+    void flush();
+    inline void sync();
+
+    inline void write(const char * data, int size) { writer.write(data, size); }
+    inline void write(const char * text);
+    inline void write(const QString & text);
+    inline void write(QLatin1String text);
+    inline void writeNumber(double number);
+
+    static bool isEmpty(const QPainterPath & path) { return path.isEmpty(); }
+    static bool isEmpty(const QPolygonF & polygon) { return polygon.isEmpty(); }
+    static bool isEmpty(const QRectF & rect) { return rect.isEmpty(); }
+    static bool isEmpty(const QLineF &) { return false; }
+    static bool isEmpty(const QTikzCircle & circle) { return circle.radius < 0; }
+
+    static QTikzBounds bounds(const QPainterPath & path)
+    {
+        // contains the curves, and is cheaper than boundingRect()
+        const QRectF rect = path.controlPointRect();
+        return QTikzBounds(rect.left(), rect.top(), rect.right(), rect.bottom());
+    }
+    static QTikzBounds bounds(const QPolygonF & polygon) { return QTikzBounds(polygon.constData(), polygon.size()); }
+    static QTikzBounds bounds(const QRectF & rect) { return QTikzBounds(rect.left(), rect.top(), rect.right(), rect.bottom()); }
+    static QTikzBounds bounds(const QLineF & line) { return QTikzBounds(line.x1(), line.y1(), line.x2(), line.y2()); }
+    static QTikzBounds bounds(const QTikzCircle & circle)
+    {
+        return QTikzBounds(circle.center.x() - circle.radius, circle.center.y() - circle.radius,
+                           circle.center.x() + circle.radius, circle.center.y() + circle.radius);
+    }
+
+    inline bool isVisible(const char * cmd, const QTikzBounds & shapeBounds);
+
+    inline quint64 & commandCount(const char * cmd);
+    void count(const char * cmd, const QPainterPath & path)
+    {
+        ++commandCount(cmd);
+        stats.elements += path.elementCount();
+    }
+    void count(const char * cmd, const QPolygonF & polygon)
+    {
+        ++commandCount(cmd);
+        stats.points += polygon.size();
+    }
+    void count(const char * cmd, const QRectF &) { ++commandCount(cmd); }
+    void count(const char * cmd, const QLineF &) { ++commandCount(cmd); }
+    void count(const char *, const QTikzCircle &) { ++stats.circles; }
+    void addCounts(const QTikzStats & other);
+    void addOutputCounts(QTikzStats & output);
+    QTikzStats currentStats() const;
+    void trace(QTikzPicture::TraceEvent event, int depth);
+
+    template <typename Shape>
+    const Shape & clipped(const char *, const Shape & shape) { return shape; }
+    const QPolygonF & clipped(const char * cmd, const QPolygonF & polygon);
+
+    template <typename Shape>
+    void writeShape(const Shape & shape) { writer.writeTikzPath(shape); }
+    void writeShape(const QPainterPath & path);
+    void writeShape(const QPainterPath & path, QByteArray * output);
+
+    void addPredefinedColor(QRgb rgb, const char * name);
+    void writeColorDefinition(const char * name, int size, QRgb rgb);
+    void defineColor(const char * name, int size, QRgb rgb);
+    int addColor(QRgb rgba);
+    QString colorName(QRgb rgba);
+    int nearestColor(QRgb rgb) const;
+
+    const QString & options(const QString & options);
+    QString newStyleName();
+    void defineStyle(const QString & options, QTikzOptionEntry & entry);
+    void defineRecordedStyle(const QString & options, const QString & style);
+    void openScope(bool hasOptions = false);
+    void closeScope();
+
+    void setSymbol(const QString & name, const QTikzSymbol & symbol);
+    void updateSymbols(const QHash<QString, QTikzSymbol> & other);
+    void defineSymbol(const QString & name, QTikzSymbol & symbol);
+    void placeSymbols(const QString & name, const QPointF * positions, int count);
+
+    void writeCommand(const char * cmd, const QString & options);
+    void writeCommand(const char * cmd, const QTikzStyle & style);
+
+    template <typename Options, typename Shape>
+    void writePath(const char * cmd, const Options & options, const Shape & shape);
+
+    template <typename Options, typename ShapeAt>
+    void writePaths(const char * cmd, const Options & options, int count, ShapeAt shapeAt);
+
+    void writeLine(const QPointF * points, int count, const QString & options);
+
+    void beginStream(StreamKind kind, const QString & options);
+    void addStreamPoints(const QPointF * points, int count);
+    void writeStreamPolyline(const QPointF * points, int count, bool continues);
+    void addStreamElement(QPainterPath::ElementType type, const QPointF & pt);
+    void endStream();
+
+    void copySettings(const QTikzPicturePrivate & source);
+    QTikzPictureState state() const;
+    void setState(const QTikzPictureState & state);
+
+    QTikzDisplayCommand & record(QTikzDisplayCommand::Type type, const char * cmd, const QString & options);
+    std::shared_future<void> submitAsync(bool finish);
+    void waitAsync();
+    void replay(const QTikzDisplayList & list);
+
+    QString imageBaseName() const;
+    void rasterNames(QTikzRasterNames & names);
+    void writeRaster(const QTikzDisplayList & list);
+};
+
+inline void QTikzPathWriter::write(const char * data, int size)
+{
+    buffer.append(data, size);
+    if (owner && buffer.size() >= owner->bufferSize) {
+        owner->flush();
+    }
+}
+
+inline quint64 & QTikzPicturePrivate::commandCount(const char * cmd)
+{
+    switch (cmd[1]) {
+        case 'd': return stats.draws;
+        case 'f': return stats.fills;
+        case 'c': return stats.clips;
+        default: return stats.paths;
+    }
+}
+
+inline void QTikzPicturePrivate::sync()
+{
+    // QTextStream users may write to the stream themselves in between,
+    // so keep the order by handing out the output after each call.
+    if (ts) {
+        flush();
+    }
+}
+
+#endif // QT_TIKZ_PICTURE_P_H
+
+// kate: replace-tabs on; indent-width 4;
@@ -0,0 +1,123 @@
+/*  Copyright (c) 2012-2013, Dominik Haumann <dhaumann@kde.org>
+    All rights reserved.
+
+    License: FreeBSD License
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "qtikzpicture_p.h"
+
+#include <QMap>
+#include <QMutex>
+#include <QMutexLocker>
+
+/**
+ * A single layer of a QTikzRecorder: a picture writing into its own buffer.
+ */
+struct QTikzRecorderLayer
+{
+    QTikzPicture picture;
+    QByteArray output;
+};
+
+/**
+ * Private data class for QTikzRecorder.
+ */
+class QTikzRecorderPrivate
+{
+public:
+    QTikzPicture & picture;
+
+    // layers by key, guarded by mutex
+    QMap<int, QTikzRecorderLayer *> layers;
+    QMutex mutex;
+
+public:
+    explicit QTikzRecorderPrivate(QTikzPicture & recordedPicture) : picture(recordedPicture) {}
+};
+
+QTikzRecorder::QTikzRecorder(QTikzPicture & picture)
+    : d(new QTikzRecorderPrivate(picture))
+{
+}
+
+QTikzRecorder::~QTikzRecorder()
+{
+    commit();
+    delete d;
+}
+
+QTikzPicture & QTikzRecorder::layer(int key)
+{
+    QMutexLocker locker(&d->mutex);
+
+    QTikzRecorderLayer * layer = d->layers.value(key);
+    if (layer) {
+        return layer->picture;
+    }
+
+    layer = new QTikzRecorderLayer;
+    d->layers.insert(key, layer);
+
+    // record with the settings of the picture, and keep the style names
+    // of the layers apart from the ones of the picture
+    QTikzPicturePrivate * source = d->picture.d;
+    QTikzPicturePrivate * target = layer->picture.d;
+    QByteArray & output = layer->output;
+    target->setSink(0, 0, [&output](const char * data, size_t size) {
+        output.append(data, int(size));
+    }, source->writer.precision);
+    target->writer.copySettings(source->writer);
+    target->pathCache = source->pathCache;
+    target->shared = source;
+    target->culling = source->culling;
+    target->cullingMargin = source->cullingMargin;
+    target->clipBounds = source->clipBounds;
+    target->clipGeometry = source->clipGeometry;
+    target->bufferSize = source->bufferSize;
+    target->styleThreshold = source->styleThreshold;
+    target->statsEnabled = source->statsEnabled;
+    target->stylePrefix = QLatin1String("l") + QString::number(key) + QLatin1String("s");
+
+    return layer->picture;
+}
+
+void QTikzRecorder::commit()
+{
+    QMutexLocker locker(&d->mutex);
+
+    QTikzPicturePrivate * target = d->picture.d;
+    const QList<int> keys = d->layers.keys();
+    for (int i = 0; i < keys.size(); ++i) {
+        QTikzRecorderLayer * layer = d->layers.value(keys[i]);
+        layer->picture.flush();
+        target->write(layer->output.constData(), layer->output.size());
+        target->addCounts(layer->picture.d->stats);
+    }
+    target->sync();
+
+    qDeleteAll(d->layers);
+    d->layers.clear();
+}
+
+// kate: replace-tabs on; indent-width 4;
@@ -0,0 +1,9 @@
+TEMPLATE = app
+TARGET = tst_qtikzpicture
+QT += core gui testlib
+CONFIG += console c++11 testcase
+CONFIG -= app_bundle
+
+include(../src/qtikzpicture.pri)
+
+SOURCES += tst_qtikzpicture.cpp
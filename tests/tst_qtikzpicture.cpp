@@ -0,0 +1,466 @@
+/*  Copyright (c) 2012-2013, Dominik Haumann <dhaumann@kde.org>
+    All rights reserved.
+
+    License: FreeBSD License
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+    IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+    IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+    THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "qtikzpicture.h"
+#include "qtikzclip_p.h"
+#include "qtikzcompressor_p.h"
+
+#include <QtTest>
+#include <QBuffer>
+#include <QColor>
+#include <QPainterPath>
+#include <QSet>
+
+/**
+ * Unit tests for QTikzPicture and its private helpers.
+ */
+class TestQTikzPicture : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void crc32();
+    void gzipEmptyOutput();
+    void gzipTrailer();
+
+    void clipSegment();
+    void clipPolyline();
+    void clipPolygon();
+
+    void resume();
+    void resumeInvalidState();
+
+    void asyncOutput();
+    void asyncStyleNames();
+};
+
+/**
+ * Draws rectangles and symbols in nested scopes, enough to fill several
+ * chunks of the asynchronous mode.
+ */
+static void drawScene(QTikzPicture & picture, bool async)
+{
+    picture.setStyleThreshold(3);
+    picture.begin();
+    if (async) {
+        picture.setAsyncMode(true, 2);
+    }
+
+    QPainterPath triangle;
+    triangle.moveTo(0, 0);
+    triangle.lineTo(1, 0);
+    triangle.lineTo(0, 1);
+    triangle.closeSubpath();
+    picture.defineSymbol("tri", triangle, "fill=red");
+
+    for (int k = 0; k < 3; ++k) {
+        picture.beginScope("thick");
+        for (int i = 0; i < 20000; ++i) {
+            picture.draw(QRectF(i * 0.01, k, 1, 1), "blue");
+            if (i % 1000 == 0) {
+                picture.placeSymbol("tri", QPointF(i, k));
+            }
+        }
+        triangle.lineTo(2, 2);
+        picture.defineSymbol("tri", triangle, "fill=green");
+        picture.placeSymbol("tri", QPointF(0, 0));
+        picture.endScope();
+    }
+
+    // switching back hands over the styles and symbols
+    if (async) {
+        picture.setAsyncMode(false);
+    }
+    picture.draw(QRectF(0, 0, 1, 1), "blue");
+    picture.placeSymbol("tri", QPointF(1, 1));
+    if (async) {
+        picture.setAsyncMode(true, 2);
+    }
+    picture.draw(QRectF(0, 0, 2, 1), "blue");
+    picture.end();
+    picture.waitForFinished();
+}
+
+/**
+ * The first and second part of the picture written by resume().
+ */
+static void drawFirstPart(QTikzPicture & picture)
+{
+    picture.setStyleThreshold(2);
+    picture.begin();
+    picture.beginScope("thick");
+
+    QPainterPath triangle;
+    triangle.moveTo(0, 0);
+    triangle.lineTo(1, 0);
+    triangle.lineTo(0, 1);
+    triangle.closeSubpath();
+    picture.defineSymbol("tri", triangle, "fill=red");
+    picture.placeSymbol("tri", QPointF(1, 1));
+
+    for (int i = 0; i < 5; ++i) {
+        picture.draw(QRectF(i, 0, 1, 1), "draw=" + picture.registerColor(QColor(10 * i, 20, 30)));
+    }
+    for (int i = 0; i < 5; ++i) {
+        picture.draw(QRectF(i, 0, 1, 1), "blue, dashed");
+    }
+}
+
+static void drawSecondPart(QTikzPicture & picture)
+{
+    for (int i = 0; i < 5; ++i) {
+        picture.draw(QRectF(i, 2, 1, 1), "blue, dashed");
+    }
+    picture.draw(QRectF(0, 0, 1, 1), "draw=" + picture.registerColor(QColor(1, 2, 3)));
+    picture.placeSymbol("tri", QPointF(2, 2));
+    picture.endScope();
+    picture.end();
+}
+
+/**
+ * Returns the little endian 32 bit number at @p offset of @p data.
+ */
+static quint32 littleEndian(const QByteArray & data, int offset)
+{
+    quint32 value = 0;
+    for (int i = 3; i >= 0; --i) {
+        value = (value << 8) | uchar(data[offset + i]);
+    }
+    return value;
+}
+
+void TestQTikzPicture::crc32()
+{
+    // check value of the CRC-32 used by gzip
+    QCOMPARE(::crc32(0, "123456789", 9), 0xcbf43926u);
+    QCOMPARE(::crc32(0, "", 0), 0u);
+
+    // continued over several blocks
+    QCOMPARE(::crc32(::crc32(0, "1234", 4), "56789", 5), 0xcbf43926u);
+}
+
+void TestQTikzPicture::gzipEmptyOutput()
+{
+    QByteArray output;
+    QBuffer buffer(&output);
+    buffer.open(QIODevice::WriteOnly);
+    {
+        QTikzPicture picture;
+        picture.setCompressedDevice(&buffer);
+    }
+
+    // a single member: header, an empty final block, and a zero trailer
+    QCOMPARE(output.size(), 20);
+    QCOMPARE(uchar(output[0]), uchar(0x1f));
+    QCOMPARE(uchar(output[1]), uchar(0x8b));
+    QCOMPARE(int(output[2]), 8);
+    QCOMPARE(int(output[10]), 3);
+    QCOMPARE(int(output[11]), 0);
+    QCOMPARE(littleEndian(output, 12), 0u);
+    QCOMPARE(littleEndian(output, 16), 0u);
+}
+
+void TestQTikzPicture::gzipTrailer()
+{
+    QByteArray plain;
+    QBuffer plainBuffer(&plain);
+    plainBuffer.open(QIODevice::WriteOnly);
+
+    QByteArray compressed;
+    QBuffer compressedBuffer(&compressed);
+    compressedBuffer.open(QIODevice::WriteOnly);
+    {
+        QTikzPicture picture;
+        picture.setDevice(&plainBuffer, 3);
+        picture.begin();
+        picture.draw(QRectF(0, 0, 1, 1), "blue");
+        picture.end();
+    }
+    {
+        QTikzPicture picture;
+        picture.setCompressedDevice(&compressedBuffer, 6, 3);
+        picture.begin();
+        picture.draw(QRectF(0, 0, 1, 1), "blue");
+        picture.end();
+    }
+
+    // the empty member of setCompressedDevice(), then the output in one member
+    QVERIFY(compressed.size() > 20 + 18);
+    QCOMPARE(uchar(compressed[20]), uchar(0x1f));
+    QCOMPARE(uchar(compressed[21]), uchar(0x8b));
+    QCOMPARE(littleEndian(compressed, compressed.size() - 8),
+             ::crc32(0, plain.constData(), plain.size()));
+    QCOMPARE(littleEndian(compressed, compressed.size() - 4), quint32(plain.size()));
+}
+
+void TestQTikzPicture::clipSegment()
+{
+    const QTikzBounds clip(0, 0, 10, 10);
+
+    // crossing two edges
+    QPointF p0(-5, 5);
+    QPointF p1(15, 5);
+    QVERIFY(::clipSegment(p0, p1, clip));
+    QCOMPARE(p0, QPointF(0, 5));
+    QCOMPARE(p1, QPointF(10, 5));
+
+    // inside, unchanged
+    p0 = QPointF(1, 2);
+    p1 = QPointF(3, 4);
+    QVERIFY(::clipSegment(p0, p1, clip));
+    QCOMPARE(p0, QPointF(1, 2));
+    QCOMPARE(p1, QPointF(3, 4));
+
+    // on an edge
+    p0 = QPointF(0, -5);
+    p1 = QPointF(0, 5);
+    QVERIFY(::clipSegment(p0, p1, clip));
+    QCOMPARE(p0, QPointF(0, 0));
+    QCOMPARE(p1, QPointF(0, 5));
+
+    // touching a corner only
+    p0 = QPointF(-5, 5);
+    p1 = QPointF(5, -5);
+    QVERIFY(::clipSegment(p0, p1, clip));
+    QCOMPARE(p0, QPointF(0, 0));
+    QCOMPARE(p1, QPointF(0, 0));
+
+    // parallel to an edge, outside
+    p0 = QPointF(-1, 0);
+    p1 = QPointF(-1, 10);
+    QVERIFY(!::clipSegment(p0, p1, clip));
+
+    // passing the corner outside
+    p0 = QPointF(-5, 4);
+    p1 = QPointF(4, -5);
+    QVERIFY(!::clipSegment(p0, p1, clip));
+
+    // degenerate segments
+    p0 = p1 = QPointF(5, 5);
+    QVERIFY(::clipSegment(p0, p1, clip));
+    QCOMPARE(p0, QPointF(5, 5));
+    p0 = p1 = QPointF(11, 5);
+    QVERIFY(!::clipSegment(p0, p1, clip));
+}
+
+void TestQTikzPicture::clipPolyline()
+{
+    const QTikzBounds clip(0, 0, 10, 10);
+    QVector<QPointF> result;
+    QVector<int> pieceEnds;
+    QVector<quint8> outcodes;
+
+    // inside: a single piece with all points
+    const QPointF inside[] = { QPointF(1, 1), QPointF(5, 1), QPointF(5, 5) };
+    ::clipPolyline(inside, 3, clip, result, pieceEnds, outcodes);
+    QCOMPARE(result, QVector<QPointF>() << inside[0] << inside[1] << inside[2]);
+    QCOMPARE(pieceEnds, QVector<int>() << 3);
+
+    // leaving and entering again: two pieces
+    result.clear();
+    pieceEnds.clear();
+    const QPointF crossing[] = { QPointF(5, 5), QPointF(15, 5), QPointF(15, 8), QPointF(5, 8) };
+    ::clipPolyline(crossing, 4, clip, result, pieceEnds, outcodes);
+    QCOMPARE(result, QVector<QPointF>() << QPointF(5, 5) << QPointF(10, 5) << QPointF(10, 8) << QPointF(5, 8));
+    QCOMPARE(pieceEnds, QVector<int>() << 2 << 4);
+
+    // crossing the clip rectangle without a point inside
+    result.clear();
+    pieceEnds.clear();
+    const QPointF through[] = { QPointF(-5, 5), QPointF(15, 5) };
+    ::clipPolyline(through, 2, clip, result, pieceEnds, outcodes);
+    QCOMPARE(result, QVector<QPointF>() << QPointF(0, 5) << QPointF(10, 5));
+    QCOMPARE(pieceEnds, QVector<int>() << 2);
+
+    // outside on the same side, trivially rejected
+    result.clear();
+    pieceEnds.clear();
+    const QPointF outside[] = { QPointF(-5, 1), QPointF(-1, 5), QPointF(-3, 20) };
+    ::clipPolyline(outside, 3, clip, result, pieceEnds, outcodes);
+    QVERIFY(result.isEmpty());
+    QVERIFY(pieceEnds.isEmpty());
+
+    // on the boundary, inside
+    result.clear();
+    pieceEnds.clear();
+    const QPointF boundary[] = { QPointF(0, 0), QPointF(10, 0) };
+    ::clipPolyline(boundary, 2, clip, result, pieceEnds, outcodes);
+    QCOMPARE(result, QVector<QPointF>() << boundary[0] << boundary[1]);
+    QCOMPARE(pieceEnds, QVector<int>() << 2);
+}
+
+void TestQTikzPicture::clipPolygon()
+{
+    const QTikzBounds clip(0, 0, 10, 10);
+    QPolygonF result;
+    QPolygonF scratch;
+
+    // inside, unchanged
+    const QPointF inside[] = { QPointF(1, 1), QPointF(5, 1), QPointF(5, 5) };
+    ::clipPolygon(inside, 3, clip, result, scratch);
+    QCOMPARE(result, QPolygonF() << inside[0] << inside[1] << inside[2]);
+
+    // outside
+    const QPointF outside[] = { QPointF(11, 1), QPointF(15, 1), QPointF(15, 5) };
+    ::clipPolygon(outside, 3, clip, result, scratch);
+    QVERIFY(result.isEmpty());
+
+    // straddling a corner
+    const QPointF corner[] = { QPointF(5, 5), QPointF(15, 5), QPointF(15, 15), QPointF(5, 15) };
+    ::clipPolygon(corner, 4, clip, result, scratch);
+    QCOMPARE(result, QPolygonF() << QPointF(5, 10) << QPointF(5, 5) << QPointF(10, 5) << QPointF(10, 10));
+
+    // covering the clip rectangle
+    const QPointF cover[] = { QPointF(-5, -5), QPointF(15, -5), QPointF(15, 15), QPointF(-5, 15) };
+    ::clipPolygon(cover, 4, clip, result, scratch);
+    QCOMPARE(result.size(), 4);
+    QVERIFY(result.contains(QPointF(0, 0)));
+    QVERIFY(result.contains(QPointF(10, 0)));
+    QVERIFY(result.contains(QPointF(10, 10)));
+    QVERIFY(result.contains(QPointF(0, 10)));
+
+    // an unbounded clip rectangle keeps the polygon
+    ::clipPolygon(outside, 3, QTikzBounds(), result, scratch);
+    QCOMPARE(result, QPolygonF() << outside[0] << outside[1] << outside[2]);
+}
+
+void TestQTikzPicture::resume()
+{
+    QByteArray reference;
+    QBuffer referenceBuffer(&reference);
+    referenceBuffer.open(QIODevice::WriteOnly);
+    {
+        QTikzPicture picture;
+        picture.setDevice(&referenceBuffer, 3);
+        drawFirstPart(picture);
+        drawSecondPart(picture);
+    }
+
+    // output after the saved state is dropped
+    QByteArray output;
+    QBuffer buffer(&output);
+    buffer.open(QIODevice::ReadWrite);
+    QByteArray state;
+    {
+        QTikzPicture picture;
+        picture.setDevice(&buffer, 3);
+        drawFirstPart(picture);
+        state = picture.saveState();
+        QVERIFY(!state.isEmpty());
+        picture.draw(QRectF(9, 9, 9, 9), "dropped by resume()");
+        picture.endScope();
+        picture.end();
+    }
+    {
+        QTikzPicture picture;
+        picture.setStyleThreshold(2);
+        QVERIFY(picture.resume(&buffer, state, 3));
+        drawSecondPart(picture);
+    }
+    QCOMPARE(output, reference);
+}
+
+void TestQTikzPicture::resumeInvalidState()
+{
+    QByteArray output;
+    QBuffer buffer(&output);
+    buffer.open(QIODevice::ReadWrite);
+
+    QTikzPicture picture;
+    QVERIFY(!picture.resume(&buffer, QByteArray("invalid"), 3));
+
+    // no state in retained mode
+    picture.setRetainedMode(true);
+    QVERIFY(picture.saveState().isEmpty());
+}
+
+void TestQTikzPicture::asyncOutput()
+{
+    QByteArray sync;
+    QTikzPicture syncPicture;
+    syncPicture.setWriteFunction([&sync](const char * data, size_t size) {
+        sync.append(data, int(size));
+    }, 3);
+    drawScene(syncPicture, false);
+
+    QByteArray async;
+    QTikzPicture asyncPicture;
+    asyncPicture.setWriteFunction([&async](const char * data, size_t size) {
+        async.append(data, int(size));
+    }, 3);
+    drawScene(asyncPicture, true);
+
+    QVERIFY(asyncPicture.isFinished());
+    QCOMPARE(async, sync);
+}
+
+void TestQTikzPicture::asyncStyleNames()
+{
+    QByteArray output;
+    {
+        QTikzPicture picture;
+        picture.setWriteFunction([&output](const char * data, size_t size) {
+            output.append(data, int(size));
+        }, 3);
+        picture.setStyleThreshold(2);
+        picture.begin();
+
+        // styles are named by the worker and by registerStyle() at once
+        picture.setAsyncMode(true, 2);
+        for (int i = 0; i < 3; ++i) {
+            picture.draw(QRectF(0, 0, 1, 1), "blue, thick");
+        }
+        const QString red = picture.registerStyle("red, dashed");
+        for (int i = 0; i < 3; ++i) {
+            picture.draw(QRectF(0, 0, 1, 1), "green, thick");
+        }
+        picture.setAsyncMode(false);
+        const QString yellow = picture.registerStyle("yellow");
+
+        picture.draw(QRectF(0, 0, 1, 1), red);
+        picture.draw(QRectF(0, 0, 1, 1), yellow);
+        picture.end();
+    }
+
+    // each style is defined once, under a name of its own
+    const QString text = QString::fromUtf8(output);
+    QSet<QString> names;
+    int definitions = 0;
+    for (int pos = text.indexOf("\\tikzset{"); pos >= 0; pos = text.indexOf("\\tikzset{", pos)) {
+        pos += 9;
+        names.insert(text.mid(pos, text.indexOf('/', pos) - pos));
+        ++definitions;
+    }
+    QCOMPARE(definitions, 4);
+    QCOMPARE(names.size(), definitions);
+}
+
+QTEST_MAIN(TestQTikzPicture)
+
+#include "tst_qtikzpicture.moc"
+
+// kate: replace-tabs on; indent-width 4;